@@ -1,6 +1,7 @@
 #include <zephyr/device.h>
 #include <zephyr/devicetree.h>
 #include <zephyr/drivers/led.h>
+#include <zephyr/drivers/sensor.h>
 #include <zephyr/kernel.h>
 #include <zephyr/init.h>
 
@@ -9,26 +10,17 @@
 #include <zmk/keymap.h>
 #include <zmk/split/bluetooth/peripheral.h>
 #include <zmk/battery.h>
+#include <zmk/activity.h>
+#include <zmk/events/activity_state_changed.h>
 #include <zmk/events/ble_active_profile_changed.h>
 #include <zmk/events/split_peripheral_status_changed.h>
 #include <zmk/events/battery_state_changed.h>
 #include <zmk/events/layer_state_changed.h>
+#include <zmk/events/hid_indicators_changed.h>
 
 #include <zephyr/logging/log.h>
 
-#define LENGTH(x)  (sizeof(x) / sizeof((x)[0]))
-#define SET_BLINK_SEQUENCE(seq) \
-do { \
-    blink.sequence = seq; \
-    blink.sequence_len = LENGTH(seq); \
-} while(0)
-
-#define BLINK_STRUCT(seq, num_repeats) \
-    (struct blink_item) { \
-        .sequence = seq, \
-        .sequence_len = LENGTH(seq), \
-        .n_repeats = num_repeats \
-    }
+#include "batt_leds.h"
 
 static const uint16_t CONFIG_INDICATOR_LED_LAYER_PATTERN[] = {80, 120};
 static const uint16_t CONFIG_INDICATOR_LED_BATTERY_CRITICAL_PATTERN[] = {40, 40};
@@ -40,253 +32,832 @@ static const uint16_t CONFIG_INDICATOR_LED_BLE_PROFILE_CONNECTED_PATTERN[] = {10
 static const uint16_t CONFIG_INDICATOR_LED_BLE_PROFILE_OPEN_PATTERN[] = {80, 80};
 // When unconnected and searching, more off than on
 static const uint16_t CONFIG_INDICATOR_LED_PROFILE_UNCONNECTED_PATTERN[] = {200, 800};
-static const uint16_t STAY_ON[] = {10};
 
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
-#define LED_GPIO_NODE_ID DT_COMPAT_GET_ANY_STATUS_OKAY(gpio_leds)
-
-// GPIO-based LED device and indices of LED inside its DT node
-static const struct device *led_dev = DEVICE_DT_GET(LED_GPIO_NODE_ID);
-
 BUILD_ASSERT(DT_NODE_EXISTS(DT_ALIAS(indicator_led)),
              "An alias for indicator-led is not found for INDICATOR_LED");
+// the LED is switched with spinlocks held, possibly from an ISR, which only these drivers allow;
+// LED controllers behind I2C or SPI sleep
+BUILD_ASSERT(DT_NODE_HAS_COMPAT(DT_PARENT(DT_ALIAS(indicator_led)), gpio_leds) ||
+                 DT_NODE_HAS_COMPAT(DT_PARENT(DT_ALIAS(indicator_led)), pwm_leds),
+             "The indicator-led alias must point into a gpio-leds or pwm-leds node");
+
+// LED device (gpio-leds, or pwm-leds to show brightness levels) and index of the LED inside it
+static const struct device *led_dev = DEVICE_DT_GET(DT_PARENT(DT_ALIAS(indicator_led)));
 static const uint8_t led_idx = DT_NODE_CHILD_IDX(DT_ALIAS(indicator_led));
 
-// flag to indicate whether the initial boot up sequence is complete
-static bool initialized = false;
 
-// a blink work item as specified by the blink rate
-struct blink_item {
-    const uint16_t *sequence;
-    size_t sequence_len;
-    uint8_t n_repeats;
+/*
+ * LED compositor: a background layer of persistent states, under the blink player's foreground
+ * layer. Each active layer is blended onto the result of the layers below it by its own rule,
+ * starting from an unlit LED. The output is only recomputed when a layer changes.
+ */
+enum led_blend {
+    // the layer replaces what is below it
+    LED_BLEND_OVERRIDE,
+    // a lit layer inverts what is below it
+    LED_BLEND_INVERT,
+    // lit only where the layer and what is below it are both lit
+    LED_BLEND_AND,
 };
 
+#if IS_ENABLED(CONFIG_INDICATOR_LED_FOREGROUND_BLEND_OVERRIDE)
+#define LED_FOREGROUND_BLEND LED_BLEND_OVERRIDE
+#elif IS_ENABLED(CONFIG_INDICATOR_LED_FOREGROUND_BLEND_AND)
+#define LED_FOREGROUND_BLEND LED_BLEND_AND
+#else
+#define LED_FOREGROUND_BLEND LED_BLEND_INVERT
+#endif
+
+struct led_layer {
+    enum led_blend blend;
+    bool active;
+    uint8_t level;
+};
+
+enum {
+    LED_LAYER_BACKGROUND,
+    LED_LAYER_FOREGROUND,
+    LED_LAYER_COUNT,
+};
+
+static struct led_layer led_layers[LED_LAYER_COUNT] = {
+    [LED_LAYER_BACKGROUND] = {.blend = LED_BLEND_OVERRIDE, .level = BLINK_LEVEL_FULL},
+    [LED_LAYER_FOREGROUND] = {.blend = LED_FOREGROUND_BLEND},
+};
+
+// owners of lit background states: held sources by id, and host indicators
+#define LED_BACKGROUND_HID BIT(ZMK_INDICATOR_LED_SOURCE_ID_MAX)
+static uint32_t led_background_owners;
+
+static struct k_spinlock led_lock;
+static uint8_t led_level;
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_GAMMA)
+// LED brightness for a perceived level, both in percent: (x^2 + x^3) / 2, about gamma 2.4, and
+// at least 1 so that dim levels stay lit; built by the preprocessor, so it sits in flash
+#define LED_GAMMA_ENTRY(i, _) ((i) == 0 ? 0 : MAX(1, ((i) * (i) * (100 + (i)) + 10000) / 20000))
 
-// define message queue of blink work items, that will be processed by a separate thread
-// Max 6 sequences; more in queue will be dropped.
-K_MSGQ_DEFINE(batt_led_msgq, sizeof(struct blink_item), 6, 1);
-
-static void led_do_blink(struct blink_item blink) {
-    led_off(led_dev, led_idx);
-    k_sleep(K_MSEC(200));
-    for (int n = 0; n < blink.n_repeats; n++) {
-        for (int i = 0; i < blink.sequence_len; i++) {
-            // on for evens (0 == start, off for odds. If the sequence contains an odd number, will stay on.
-            if (i%2 == 0){
-                led_on(led_dev, led_idx);
-            } else {
-                led_off(led_dev, led_idx);
-            }
-            uint16_t blink_time = blink.sequence[i];
-            k_sleep(K_MSEC(blink_time));
+static const uint8_t led_gamma[] = {LISTIFY(101, LED_GAMMA_ENTRY, (,))};
+BUILD_ASSERT(ARRAY_SIZE(led_gamma) == BLINK_LEVEL_FULL + 1, "Gamma table must cover all levels");
+
+#define LED_BRIGHTNESS(level) led_gamma[level]
+#else
+#define LED_BRIGHTNESS(level) (level)
+#endif
+
+static uint8_t led_blend(enum led_blend blend, uint8_t below, uint8_t level) {
+    switch (blend) {
+    case LED_BLEND_INVERT:
+        return below > level ? below - level : level - below;
+    case LED_BLEND_AND:
+        return MIN(below, level);
+    case LED_BLEND_OVERRIDE:
+    default:
+        return level;
+    }
+}
+
+// drive the LED from the layers, with led_lock held
+static void led_composite(void) {
+    uint8_t level = 0;
+    for (size_t i = 0; i < LED_LAYER_COUNT; i++) {
+        if (led_layers[i].active) {
+            level = led_blend(led_layers[i].blend, level, led_layers[i].level);
+        }
+    }
+
+    if (level == led_level) {
+        return;
+    }
+    led_level = level;
+    BATT_LED_TRACE("edge", led_idx, level);
+    if (level == BLINK_LEVEL_FULL) {
+        led_on(led_dev, led_idx);
+    } else if (level == 0) {
+        led_off(led_dev, led_idx);
+    } else {
+        led_set_brightness(led_dev, led_idx, LED_BRIGHTNESS(level));
+    }
+}
+
+// change which owners hold the background lit; callable from any thread or ISR
+void batt_led_background_update(uint32_t clear, uint32_t set) {
+    K_SPINLOCK(&led_lock) {
+        led_background_owners = (led_background_owners & ~clear) | set;
+        led_layers[LED_LAYER_BACKGROUND].active = led_background_owners != 0;
+        led_composite();
+    }
+}
+
+void batt_led_foreground_update(bool active, uint8_t level) {
+    K_SPINLOCK(&led_lock) {
+        led_layers[LED_LAYER_FOREGROUND].active = active;
+        led_layers[LED_LAYER_FOREGROUND].level = level;
+        led_composite();
+    }
+}
+
+void batt_led_compositor_state(uint8_t *level, bool *background) {
+    K_SPINLOCK(&led_lock) {
+        *level = led_level;
+        *background = led_background_owners != 0;
+    }
+}
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_HID_INDICATORS)
+static int batt_led_hid_indicators_listener_cb(const zmk_event_t *eh) {
+    zmk_hid_indicators_t indicators = as_zmk_hid_indicators_changed(eh)->indicators;
+
+    // straight to the LED, not through the blink queue; sequences are composited on top
+    bool lit = indicators & CONFIG_INDICATOR_LED_HID_INDICATORS_MASK;
+    batt_led_background_update(LED_BACKGROUND_HID, lit ? LED_BACKGROUND_HID : 0);
+    return 0;
+}
+
+ZMK_LISTENER(batt_led_hid_indicators_listener, batt_led_hid_indicators_listener_cb);
+ZMK_SUBSCRIPTION(batt_led_hid_indicators_listener, zmk_hid_indicators_changed);
+#endif // IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_HID_INDICATORS)
+
+
+// everything below queues blink sequences, and only exists when something does
+#if IS_ENABLED(CONFIG_INDICATOR_LED_PLAYER)
+// lifecycle of the widget; events are only shown once the boot indications are queued
+enum batt_led_lifecycle {
+    BATT_LED_BOOTING,
+    BATT_LED_BOOT_INDICATING,
+    BATT_LED_READY,
+};
+
+static atomic_t lifecycle = ATOMIC_INIT(BATT_LED_BOOTING);
+
+static void boot_timer_expiry(struct batt_led_timer *timer);
+
+// runs the boot indications, once the state they show is known
+static struct batt_led_timer boot_timer = BATT_LED_TIMER_INITIALIZER(boot_timer_expiry);
+
+// sources that had events before the widget was ready, by registry index; replayed once from
+// their current state, so any number of early events costs one bit
+#define BATT_LED_SOURCES_MAX 16
+static ATOMIC_DEFINE(pending_sources, BATT_LED_SOURCES_MAX);
+
+
+// how long the battery part of a composite boot sequence should take
+#define BOOT_COMPOSITE_BATTERY_MS 500
+
+
+const struct batt_led_source *batt_led_source_find(uint8_t id) {
+    STRUCT_SECTION_FOREACH(batt_led_source, src) {
+        if (src->id == id) {
+            return src;
+        }
+    }
+    return NULL;
+}
+
+int batt_led_source_show(const struct batt_led_source *src, const zmk_event_t *eh) {
+    struct batt_led_indication ind = {};
+    if (src->classify == NULL || !src->classify(eh, &ind) || ind.n_repeats == 0) {
+        return 0;
+    }
+
+    if ((src->flags & BATT_LED_SOURCE_DEDUP) && src->state->has_key &&
+        src->state->last_key == ind.key) {
+        LOG_DBG("Indication for %s unchanged, not blinking", src->name);
+        return 0;
+    }
+    src->state->last_key = ind.key;
+    src->state->has_key = true;
+#if IS_ENABLED(CONFIG_INDICATOR_LED_RETAINED_STATE)
+    if (src->flags & BATT_LED_SOURCE_RETAIN) {
+        batt_led_retained_save(src->id, ind.key);
+    }
+#endif
+
+    __ASSERT(ind.pattern < src->pattern_count, "Pattern index out of range");
+    struct blink_item blink = {
+        .pattern = &src->patterns[ind.pattern],
+        .source = src->id,
+        .n_repeats = ind.n_repeats,
+        .priority = src->priority,
+        .flags = ind.flags,
+    };
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_RELAY) && IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL)
+    if (src->flags & BATT_LED_SOURCE_RELAY) {
+        batt_led_relay_push(src, &blink);
+        if (IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_SYNC)) {
+            // queued locally by the relay, with the same start time as on the peripherals
+            return 0;
+        }
+    }
+#endif
+
+    if (batt_led_enqueue(&blink) < 0) {
+        LOG_DBG("Blink queue full, dropping indication for %s", src->name);
+    }
+    return 0;
+}
+
+int batt_led_source_event(const struct batt_led_source *src, const zmk_event_t *eh) {
+    if (atomic_get(&lifecycle) == BATT_LED_READY) {
+        return batt_led_source_show(src, eh);
+    }
+
+    uint8_t index = batt_led_source_index(src);
+    __ASSERT(index < BATT_LED_SOURCES_MAX, "Too many indication sources");
+    atomic_set_bit(pending_sources, index);
+
+    // the replay may have run between the check above and setting the bit, whoever clears the
+    // bit shows the source
+    if (atomic_get(&lifecycle) == BATT_LED_READY &&
+        atomic_test_and_clear_bit(pending_sources, index)) {
+        return batt_led_source_show(src, NULL);
+    }
+    return 0;
+}
+
+// show the current state of sources that had events during boot
+static void replay_pending_sources(void) {
+    STRUCT_SECTION_FOREACH(batt_led_source, src) {
+        uint8_t index = batt_led_source_index(src);
+        if (index < BATT_LED_SOURCES_MAX && atomic_test_and_clear_bit(pending_sources, index)) {
+            LOG_DBG("Replaying early event for %s", src->name);
+            batt_led_source_show(src, NULL);
         }
     }
 }
 
 #if IS_ENABLED(CONFIG_ZMK_BLE) && IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BLE)
-static void indicate_ble(void) {
-    struct blink_item blink = {};
+enum {
+    BLE_PATTERN_CONNECTED,
+    BLE_PATTERN_OPEN,
+    BLE_PATTERN_UNCONNECTED,
+};
 
+static const struct zmk_indicator_led_pattern ble_patterns[] = {
+    [BLE_PATTERN_CONNECTED] = BLINK_PATTERN(CONFIG_INDICATOR_LED_BLE_PROFILE_CONNECTED_PATTERN),
+    [BLE_PATTERN_OPEN] = BLINK_PATTERN(CONFIG_INDICATOR_LED_BLE_PROFILE_OPEN_PATTERN),
+    [BLE_PATTERN_UNCONNECTED] = BLINK_PATTERN(CONFIG_INDICATOR_LED_PROFILE_UNCONNECTED_PATTERN),
+};
+
+static bool classify_ble(const zmk_event_t *eh, struct batt_led_indication *ind) {
 #if IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL) || !IS_ENABLED(CONFIG_ZMK_SPLIT)
     uint8_t profile_index = zmk_ble_active_profile_index() + 1;
     if (zmk_ble_active_profile_is_connected()) {
         LOG_INF("Profile %d connected, blinking for connected", profile_index);
-        SET_BLINK_SEQUENCE(CONFIG_INDICATOR_LED_BLE_PROFILE_CONNECTED_PATTERN);
-        blink.n_repeats = profile_index;
+        ind->pattern = BLE_PATTERN_CONNECTED;
     } else if (zmk_ble_active_profile_is_open()) {
         LOG_INF("Profile %d open, blinking for open", profile_index);
-        SET_BLINK_SEQUENCE(CONFIG_INDICATOR_LED_BLE_PROFILE_OPEN_PATTERN);
-        blink.n_repeats = profile_index;
+        ind->pattern = BLE_PATTERN_OPEN;
     } else {
         LOG_INF("Profile %d not connected, blinking for unconnected", profile_index);
-        SET_BLINK_SEQUENCE(CONFIG_INDICATOR_LED_PROFILE_UNCONNECTED_PATTERN);
-        blink.n_repeats = profile_index;
+        ind->pattern = BLE_PATTERN_UNCONNECTED;
+    }
+    ind->n_repeats = profile_index;
+    ind->flags = BLINK_FLAG_INDEX | BLINK_FLAG_INDEX_HEADER;
+    ind->key = (profile_index << 8) | ind->pattern;
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BOOT_COMPOSITE)
+    if (atomic_get(&lifecycle) == BATT_LED_BOOT_INDICATING) {
+        // right after the battery part, its status pattern once and the profile in short and
+        // long pulses
+        ind->flags |= BLINK_FLAG_CHAIN;
     }
-    k_msgq_put(&batt_led_msgq, &blink, K_NO_WAIT);
 #endif
-#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_PERIPHERAL_BLE) && \
-    IS_ENABLED(CONFIG_ZMK_SPLIT) && \
-    !IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL)
+    return true;
+#elif IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_PERIPHERAL_BLE)
     if (zmk_split_bt_peripheral_is_connected()) {
         LOG_INF("Peripheral connected, blinking once");
-        SET_BLINK_SEQUENCE(CONFIG_INDICATOR_LED_BLE_PROFILE_CONNECTED_PATTERN);
-        blink.n_repeats = 1;
+        ind->pattern = BLE_PATTERN_CONNECTED;
+        ind->n_repeats = 1;
     } else {
         LOG_INF("Peripheral not connected, blinking for unconnected");
-        SET_BLINK_SEQUENCE(CONFIG_INDICATOR_LED_PROFILE_UNCONNECTED_PATTERN);
-        blink.n_repeats = 10;
+        ind->pattern = BLE_PATTERN_UNCONNECTED;
+        ind->n_repeats = 10;
     }
-    k_msgq_put(&batt_led_msgq, &blink, K_NO_WAIT);
+    ind->key = ind->pattern;
+    return true;
+#else
+    return false;
 #endif
+}
+
+BATT_LED_SOURCE_DEFINE(ble, BATT_LED_SOURCE_ID_BLE, classify_ble, ble_patterns,
+                       BATT_LED_PRIO_NORMAL,
+                       BATT_LED_SOURCE_DEDUP | BATT_LED_SOURCE_RELAY | BATT_LED_SOURCE_RETAIN);
+BATT_LED_SOURCE_LISTENER(ble);
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL) || !IS_ENABLED(CONFIG_ZMK_SPLIT)
+// show the BLE source on BLE profile change (on central)
+BATT_LED_SOURCE_SUBSCRIPTION(ble, zmk_ble_active_profile_changed);
+#else
+// show the BLE source on peripheral status change event
+BATT_LED_SOURCE_SUBSCRIPTION(ble, zmk_split_peripheral_status_changed);
+#endif
+
+#endif // IS_ENABLED(CONFIG_ZMK_BLE)
+
 
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BATTERY)
+
+enum {
+    BATTERY_PATTERN_HIGH,
+    BATTERY_PATTERN_LOW,
+    BATTERY_PATTERN_CRITICAL,
+    BATTERY_PATTERN_DROPPING,
+};
+
+static const struct zmk_indicator_led_pattern battery_patterns[] = {
+    [BATTERY_PATTERN_HIGH] = BLINK_PATTERN(CONFIG_INDICATOR_LED_BATTERY_HIGH_PATTERN),
+    [BATTERY_PATTERN_LOW] = BLINK_PATTERN(CONFIG_INDICATOR_LED_BATTERY_LOW_PATTERN),
+    [BATTERY_PATTERN_CRITICAL] = BLINK_PATTERN(CONFIG_INDICATOR_LED_BATTERY_CRITICAL_PATTERN),
+    // blinks speeding up, like the runtime running out
+    [BATTERY_PATTERN_DROPPING] = ZMK_INDICATOR_LED_CHIRP(400, 100, 8),
+};
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_PERIPHERAL_BATTERY)
+#define BATTERY_HALVES (1 + CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS)
+
+// last level reported by each peripheral, 0 while unknown; the central fetches these anyway
+static uint8_t peripheral_battery_levels[CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS];
+#else
+#define BATTERY_HALVES 1
+#endif
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT)
+// level read straight from the battery sensor at boot, until ZMK has sampled it itself
+static uint8_t battery_sensor_level;
+
+// sample the zmk,battery sensor right away instead of waiting for ZMK's sampling interval;
+// 0 if the sensor cannot report a state of charge on demand
+static uint8_t battery_sensor_fetch(void) {
+#if DT_HAS_CHOSEN(zmk_battery)
+    const struct device *battery = DEVICE_DT_GET(DT_CHOSEN(zmk_battery));
+    struct sensor_value state_of_charge;
+
+    if (!device_is_ready(battery) ||
+        sensor_sample_fetch_chan(battery, SENSOR_CHAN_GAUGE_STATE_OF_CHARGE) < 0 ||
+        sensor_channel_get(battery, SENSOR_CHAN_GAUGE_STATE_OF_CHARGE, &state_of_charge) < 0) {
+        return 0;
+    }
+    return CLAMP(state_of_charge.val1, 0, 100);
+#else
+    return 0;
+#endif
 }
+#endif
 
-static int batt_led_output_listener_cb(const zmk_event_t *eh) {
-#if IS_ENABLED(CONFIG_ZMK_BLE) && IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BLE)
-    if (initialized) {
-        indicate_ble();
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT) || \
+    IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_CRITICAL_BATTERY_CHANGES)
+// battery level of a half, 0 being this one, or 0 if not known yet
+static uint8_t battery_half_level(uint8_t half) {
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_PERIPHERAL_BATTERY)
+    if (half > 0) {
+        return half < BATTERY_HALVES ? peripheral_battery_levels[half - 1] : 0;
     }
 #endif
-    return 0;
+    uint8_t level = zmk_battery_state_of_charge();
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT)
+    if (level == 0) {
+        return battery_sensor_level;
+    }
+#endif
+    return level;
 }
+#endif
 
-ZMK_LISTENER(batt_led_output_listener, batt_led_output_listener_cb);
-#if IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL) || !IS_ENABLED(CONFIG_ZMK_SPLIT)
-// run batt_led_output_listener_cb on BLE profile change (on central)
-ZMK_SUBSCRIPTION(batt_led_output_listener, zmk_ble_active_profile_changed);
-#else
-// // run batt_led_output_listener_cb on peripheral status change event
-ZMK_SUBSCRIPTION(batt_led_output_listener, zmk_split_peripheral_status_changed);
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_CRITICAL_BATTERY_CHANGES) || \
+    (IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT) && \
+     !IS_ENABLED(CONFIG_INDICATOR_LED_PERIPHERAL_BATTERY_PER_HALF))
+// lowest known battery level of all halves
+static uint8_t battery_level_min(void) {
+    uint8_t level = 0;
+    for (uint8_t half = 0; half < BATTERY_HALVES; half++) {
+        uint8_t half_level = battery_half_level(half);
+        if (half_level > 0 && (level == 0 || half_level < level)) {
+            level = half_level;
+        }
+    }
+    return level;
+}
 #endif
 
-#endif // IS_ENABLED(CONFIG_ZMK_BLE)
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_CRITICAL_BATTERY_CHANGES)
+// battery level smoothed over a few samples, in 1/16 %; 0 until the first sample
+static uint16_t battery_filtered_x16;
+static bool battery_critical;
+static uint32_t critical_reminder_s = CONFIG_INDICATOR_LED_CRITICAL_REMINDER_MIN_S;
 
+static uint8_t battery_filtered_level(void) {
+    return (battery_filtered_x16 + 8) / 16;
+}
 
-#if IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING)
+static bool classify_battery_critical(const zmk_event_t *eh, struct batt_led_indication *ind) {
+    if (!battery_critical) {
+        return false;
+    }
 
-#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_CRITICAL_BATTERY_CHANGES)
-static int batt_led_battery_listener_cb(const zmk_event_t *eh) {
-    if (!initialized) {
-        return 0;
+    LOG_INF("Battery level %d, blinking for critical", battery_filtered_level());
+    ind->pattern = BATTERY_PATTERN_CRITICAL;
+    ind->n_repeats = 1;
+    ind->key = battery_filtered_level();
+    return true;
+}
+
+BATT_LED_SOURCE_DEFINE(battery_critical, BATT_LED_SOURCE_ID_BATTERY_CRITICAL,
+                       classify_battery_critical, battery_patterns, BATT_LED_PRIO_CRITICAL, 0);
+
+static void critical_reminder_expiry(struct batt_led_timer *timer) {
+    if (!battery_critical || zmk_activity_get_state() != ZMK_ACTIVITY_ACTIVE) {
+        // nobody is looking, activity restarts the reminder
+        return;
     }
 
-    // check if we are in critical battery levels at state change, blink if we are
-    uint8_t battery_level = as_zmk_battery_state_changed(eh)->state_of_charge;
+    batt_led_source_event(&batt_led_source_battery_critical, NULL);
+    batt_led_timer_start_in(timer, critical_reminder_s * MSEC_PER_SEC);
+    critical_reminder_s = MIN(critical_reminder_s * 2, CONFIG_INDICATOR_LED_CRITICAL_REMINDER_MAX_S);
+}
+
+static struct batt_led_timer critical_reminder_timer =
+    BATT_LED_TIMER_INITIALIZER(critical_reminder_expiry);
+
+static void critical_reminder_restart(void) {
+    critical_reminder_s = CONFIG_INDICATOR_LED_CRITICAL_REMINDER_MIN_S;
+    batt_led_timer_start(&critical_reminder_timer, k_uptime_get());
+}
 
-    if (battery_level > 0 && battery_level <= CONFIG_INDICATOR_LED_BATTERY_LEVEL_CRITICAL) {
-        LOG_INF("Battery level %d, blinking for critical", battery_level);
+static void battery_critical_update(uint8_t level) {
+    if (level == 0) {
+        // level not determined yet
+        return;
+    }
+
+    if (battery_filtered_x16 == 0) {
+        battery_filtered_x16 = level * 16;
+    } else {
+        battery_filtered_x16 += (level * 16 - battery_filtered_x16) / 4;
+    }
 
-        static const struct blink_item blink = BLINK_STRUCT(
-            CONFIG_INDICATOR_LED_BATTERY_CRITICAL_PATTERN, 1
-        );
-        k_msgq_put(&batt_led_msgq, &blink, K_NO_WAIT);
+    uint8_t filtered = battery_filtered_level();
+    if (!battery_critical && filtered <= batt_led_cfg.battery_level_critical) {
+        LOG_INF("Battery level %d crossed critical, starting reminders", filtered);
+        battery_critical = true;
+        critical_reminder_restart();
+    } else if (battery_critical &&
+               filtered > batt_led_cfg.battery_level_critical +
+                              CONFIG_INDICATOR_LED_CRITICAL_HYSTERESIS) {
+        LOG_INF("Battery level %d above critical, stopping reminders", filtered);
+        battery_critical = false;
+        batt_led_timer_cancel(&critical_reminder_timer);
+    }
+}
+
+static int batt_led_battery_critical_listener_cb(const zmk_event_t *eh) {
+    if (as_zmk_battery_state_changed(eh) != NULL) {
+        battery_critical_update(battery_level_min());
+        return 0;
+    }
+
+    const struct zmk_activity_state_changed *activity_ev = as_zmk_activity_state_changed(eh);
+    if (activity_ev != NULL && activity_ev->state == ZMK_ACTIVITY_ACTIVE && battery_critical) {
+        // back from idle, remind right away and start backing off again
+        critical_reminder_restart();
     }
     return 0;
 }
-// run batt_led_battery_listener_cb on battery state change event
-ZMK_LISTENER(batt_led_battery_listener, batt_led_battery_listener_cb);
-ZMK_SUBSCRIPTION(batt_led_battery_listener, zmk_battery_state_changed);
+
+// the level drives the reminder timer, it no longer blinks on every battery event
+ZMK_LISTENER(batt_led_battery_critical_listener, batt_led_battery_critical_listener_cb);
+ZMK_SUBSCRIPTION(batt_led_battery_critical_listener, zmk_battery_state_changed);
+ZMK_SUBSCRIPTION(batt_led_battery_critical_listener, zmk_activity_state_changed);
+#endif
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BATTERY_HISTORY)
+// hours of runtime left at the last blink, the threshold before the first one
+static uint32_t battery_runtime_shown_hours = CONFIG_INDICATOR_LED_BATTERY_RUNTIME_HOURS;
+
+static bool classify_battery_runtime(const zmk_event_t *eh, struct batt_led_indication *ind) {
+    uint32_t minutes;
+    if (batt_led_history_time_to_empty(&minutes) < 0) {
+        return false;
+    }
+    if (minutes >= CONFIG_INDICATOR_LED_BATTERY_RUNTIME_HOURS * 60) {
+        // enough left again, e.g. after charging, so blink anew once it gets short
+        battery_runtime_shown_hours = CONFIG_INDICATOR_LED_BATTERY_RUNTIME_HOURS;
+        return false;
+    }
+    // blink again for every hour less, but not when the estimate goes back up and down
+    if (minutes / 60 >= battery_runtime_shown_hours) {
+        return false;
+    }
+    battery_runtime_shown_hours = minutes / 60;
+
+    LOG_INF("About %u minutes of battery left, blinking for low runtime", minutes);
+    ind->pattern = BATTERY_PATTERN_DROPPING;
+    ind->n_repeats = 1;
+    ind->key = minutes / 60;
+    return true;
+}
+
+BATT_LED_SOURCE_DEFINE(battery_runtime, BATT_LED_SOURCE_ID_BATTERY_RUNTIME,
+                       classify_battery_runtime, battery_patterns, BATT_LED_PRIO_HIGH, 0);
+
+static int batt_led_battery_runtime_listener_cb(const zmk_event_t *eh) {
+    batt_led_history_add(as_zmk_battery_state_changed(eh)->state_of_charge);
+    return batt_led_source_event(&batt_led_source_battery_runtime, eh);
+}
+
+// record every battery level, then check the estimated runtime
+ZMK_LISTENER(batt_led_battery_runtime_listener, batt_led_battery_runtime_listener_cb);
+ZMK_SUBSCRIPTION(batt_led_battery_runtime_listener, zmk_battery_state_changed);
 #endif
 
 #if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT)
-static void indicate_startup_battery(void) {
-    // check and indicate battery level on thread start
-    LOG_INF("Indicating initial battery status");
-
-    struct blink_item blink = {};
-    uint8_t battery_level = zmk_battery_state_of_charge();
-    int retry = 0;
-    while (battery_level == 0 && retry++ < 10) {
-        k_sleep(K_MSEC(100));
-        battery_level = zmk_battery_state_of_charge();
-    };
+#if IS_ENABLED(CONFIG_INDICATOR_LED_PERIPHERAL_BATTERY_PER_HALF)
+// halves whose level is still to be shown, one bit each; the lowest goes first
+static atomic_t battery_boot_halves;
+
+// take the next half to show, false if there is none
+static bool battery_boot_next_half(uint8_t *half) {
+    atomic_val_t halves;
+
+    do {
+        halves = atomic_get(&battery_boot_halves);
+        if (halves == 0) {
+            return false;
+        }
+    } while (!atomic_cas(&battery_boot_halves, halves, halves & (halves - 1)));
+
+    *half = __builtin_ctz(halves);
+    return true;
+}
+#endif
+
+static bool classify_battery_boot(const zmk_event_t *eh, struct batt_led_indication *ind) {
+#if IS_ENABLED(CONFIG_INDICATOR_LED_PERIPHERAL_BATTERY_PER_HALF)
+    uint8_t half;
+    if (!battery_boot_next_half(&half)) {
+        return false;
+    }
+    uint8_t battery_level = battery_half_level(half);
+#else
+    uint8_t battery_level = battery_level_min();
+#endif
 
     if (battery_level == 0) {
         LOG_INF("Startup Battery level undetermined (zero), blinking off");
-        blink.sequence_len = 0;
-        blink.n_repeats = 0;
-    } else if (battery_level >= CONFIG_INDICATOR_LED_BATTERY_LEVEL_HIGH) {
+        return false;
+    } else if (battery_level >= batt_led_cfg.battery_level_high) {
         LOG_INF("Startup Battery level %d, blinking for high", battery_level);
-        SET_BLINK_SEQUENCE(CONFIG_INDICATOR_LED_BATTERY_HIGH_PATTERN);
-        blink.n_repeats = CONFIG_INDICATOR_LED_BATTERY_HIGH_BLINK_REPEAT;
-    } else if (battery_level <= CONFIG_INDICATOR_LED_BATTERY_LEVEL_CRITICAL){
+        ind->pattern = BATTERY_PATTERN_HIGH;
+        ind->n_repeats = batt_led_cfg.battery_high_blink_repeat;
+    } else if (battery_level <= batt_led_cfg.battery_level_critical){
         LOG_INF("Startup Battery level %d, blinking for critical", battery_level);
-        SET_BLINK_SEQUENCE(CONFIG_INDICATOR_LED_BATTERY_CRITICAL_PATTERN);
-        blink.n_repeats = CONFIG_INDICATOR_LED_BATTERY_CRITICAL_BLINK_REPEAT;
-    } else if (battery_level <= CONFIG_INDICATOR_LED_BATTERY_LEVEL_LOW) {
+        ind->pattern = BATTERY_PATTERN_CRITICAL;
+        ind->n_repeats = batt_led_cfg.battery_critical_blink_repeat;
+    } else if (battery_level <= batt_led_cfg.battery_level_low) {
         LOG_INF("Startup Battery level %d, blinking for low", battery_level);
-        SET_BLINK_SEQUENCE(CONFIG_INDICATOR_LED_BATTERY_LOW_PATTERN);
-        blink.n_repeats = CONFIG_INDICATOR_LED_BATTERY_LOW_BLINK_REPEAT;
+        ind->pattern = BATTERY_PATTERN_LOW;
+        ind->n_repeats = batt_led_cfg.battery_low_blink_repeat;
     } else {
-        blink.n_repeats = 0;
+        return false;
+    }
+    ind->key = ind->pattern;
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BOOT_COMPOSITE)
+    bool composite = atomic_get(&lifecycle) == BATT_LED_BOOT_INDICATING;
+    if (composite) {
+        // the pattern's pace already tells the class, so play it for about
+        // BOOT_COMPOSITE_BATTERY_MS; the boot indications after it chain onto it
+        struct blink_item once = {.pattern = &battery_patterns[ind->pattern], .n_repeats = 1};
+        uint32_t period_ms = blink_item_duration_ms(&once);
+        ind->n_repeats = MAX(1, BOOT_COMPOSITE_BATTERY_MS / period_ms);
     }
+#endif
+#if IS_ENABLED(CONFIG_INDICATOR_LED_PERIPHERAL_BATTERY_PER_HALF)
+    // the pattern shows the level, its count which half it is
+    LOG_INF("Battery level of half %d", half);
+    ind->n_repeats = half + 1;
+    ind->flags |= BLINK_FLAG_INDEX | BLINK_FLAG_INDEX_HEADER;
+    ind->key |= half << 8;
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BOOT_COMPOSITE)
+    if (composite && half > 0) {
+        // the halves after the first follow the battery part of the one before
+        ind->flags |= BLINK_FLAG_CHAIN;
+    }
+#endif
+#endif
+    return true;
+}
+
+// levels of peripherals that report later are only shown if they change what was shown
+BATT_LED_SOURCE_DEFINE(battery_boot, BATT_LED_SOURCE_ID_BATTERY_BOOT, classify_battery_boot,
+                       battery_patterns, BATT_LED_PRIO_HIGH,
+                       BATT_LED_SOURCE_DEDUP | BATT_LED_SOURCE_RETAIN);
 
-    k_msgq_put(&batt_led_msgq, &blink, K_NO_WAIT);
+#if IS_ENABLED(CONFIG_INDICATOR_LED_PERIPHERAL_BATTERY_PER_HALF)
+// show every half queued in battery_boot_halves
+static void battery_boot_show_halves(void) {
+    while (atomic_get(&battery_boot_halves) != 0) {
+        batt_led_source_show(&batt_led_source_battery_boot, NULL);
+    }
 }
 #endif
 
-#endif // IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING)
+// how long to wait for ZMK's first battery sample when the sensor cannot be read on demand
+#define BOOT_BATTERY_TIMEOUT_MS 1000
 
+enum boot_battery_wait {
+    BOOT_BATTERY_START,
+    BOOT_BATTERY_WAITING,
+    BOOT_BATTERY_DONE,
+};
 
-#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_LAYER_CHANGE)
-#if IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL) || !IS_ENABLED(CONFIG_ZMK_SPLIT)
-static int batt_led_layer_listener_cb(const zmk_event_t *eh) {
-    if (!initialized) {
-        return 0;
+static atomic_t boot_battery_wait = ATOMIC_INIT(BOOT_BATTERY_START);
+
+// returns false while still waiting for the battery level to be known
+static bool indicate_startup_battery(void) {
+    // check and indicate battery level on boot
+    // the listener below may end the wait too, and whichever does so first shows it: when the
+    // listener wins, it has woken this up again, and that run finds the wait done
+    if (atomic_get(&boot_battery_wait) == BOOT_BATTERY_START) {
+        LOG_INF("Indicating initial battery status");
+        // woken up early by the first battery event, armed before the listener may wake it
+        batt_led_timer_start_in(&boot_timer, BOOT_BATTERY_TIMEOUT_MS);
+        atomic_set(&boot_battery_wait, BOOT_BATTERY_WAITING);
+        if (zmk_battery_state_of_charge() == 0) {
+            battery_sensor_level = battery_sensor_fetch();
+        }
+        if (battery_half_level(0) == 0 ||
+            !atomic_cas(&boot_battery_wait, BOOT_BATTERY_WAITING, BOOT_BATTERY_DONE)) {
+            return false;
+        }
+        batt_led_timer_cancel(&boot_timer);
+    } else if (atomic_get(&boot_battery_wait) == BOOT_BATTERY_WAITING) {
+        if (!atomic_cas(&boot_battery_wait, BOOT_BATTERY_WAITING, BOOT_BATTERY_DONE)) {
+            return false;
+        }
+        LOG_INF("No battery level after %d ms", BOOT_BATTERY_TIMEOUT_MS);
     }
 
-    // // ignore layer off events
-    // if (!as_zmk_layer_state_changed(eh)->state) {
-    //     return 0;
-    // }
+#if IS_ENABLED(CONFIG_INDICATOR_LED_PERIPHERAL_BATTERY_PER_HALF)
+    // halves not known yet are shown once they report, see the peripheral listener below
+    atomic_or(&battery_boot_halves, BIT_MASK(BATTERY_HALVES));
+    battery_boot_show_halves();
+#else
+    batt_led_source_show(&batt_led_source_battery_boot, NULL);
+#endif
+    return true;
+}
 
-    uint8_t index = zmk_keymap_highest_layer_active()+1;
-    LOG_INF("Changed to layer %d", index);
-    struct blink_item blink = BLINK_STRUCT(
-        CONFIG_INDICATOR_LED_LAYER_PATTERN, index
-    );
-    k_msgq_put(&batt_led_msgq, &blink, K_NO_WAIT);
-    if (zmk_keymap_highest_layer_active() >=
-        CONFIG_INDICATOR_LED_LAYER_PERSISTENCE_THRESHOLD) {
-        blink = BLINK_STRUCT(
-            STAY_ON, 1
-        );
-        k_msgq_put(&batt_led_msgq, &blink, K_NO_WAIT);
+static int batt_led_battery_boot_listener_cb(const zmk_event_t *eh) {
+    if (atomic_cas(&boot_battery_wait, BOOT_BATTERY_WAITING, BOOT_BATTERY_DONE)) {
+        batt_led_timer_start(&boot_timer, k_uptime_get());
+    }
+    return 0;
+}
+
+// ends the wait for the first battery level
+ZMK_LISTENER(batt_led_battery_boot_listener, batt_led_battery_boot_listener_cb);
+ZMK_SUBSCRIPTION(batt_led_battery_boot_listener, zmk_battery_state_changed);
+#endif
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_PERIPHERAL_BATTERY)
+static int batt_led_peripheral_battery_listener_cb(const zmk_event_t *eh) {
+    const struct zmk_peripheral_battery_state_changed *ev =
+        as_zmk_peripheral_battery_state_changed(eh);
+    if (ev->source >= CONFIG_ZMK_SPLIT_BLE_CENTRAL_PERIPHERALS) {
+        return 0;
+    }
 
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT)
+    bool first = peripheral_battery_levels[ev->source] == 0;
+#endif
+    peripheral_battery_levels[ev->source] = ev->state_of_charge;
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_CRITICAL_BATTERY_CHANGES)
+    battery_critical_update(battery_level_min());
+#endif
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT)
+    // peripherals usually connect after the boot indication, show their level once it is known
+    if (first && ev->state_of_charge > 0) {
+#if IS_ENABLED(CONFIG_INDICATOR_LED_PERIPHERAL_BATTERY_PER_HALF)
+        // before the widget is ready, the boot indication or the replay shows it
+        atomic_or(&battery_boot_halves, BIT(ev->source + 1));
+        if (atomic_get(&lifecycle) == BATT_LED_READY) {
+            battery_boot_show_halves();
+        }
+#else
+        batt_led_source_event(&batt_led_source_battery_boot, eh);
+#endif
     }
+#endif
     return 0;
 }
 
-ZMK_LISTENER(batt_led_layer_listener, batt_led_layer_listener_cb);
-ZMK_SUBSCRIPTION(batt_led_layer_listener, zmk_layer_state_changed);
+// cache the levels the central already fetches from its peripherals
+ZMK_LISTENER(batt_led_peripheral_battery_listener, batt_led_peripheral_battery_listener_cb);
+ZMK_SUBSCRIPTION(batt_led_peripheral_battery_listener, zmk_peripheral_battery_state_changed);
 #endif
-#endif // IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_LAYER_CHANGE)
 
+#endif // IS_ENABLED(CONFIG_INDICATOR_LED_BATTERY)
 
-extern void batt_led_process_thread(void *d0, void *d1, void *d2) {
-    ARG_UNUSED(d0);
-    ARG_UNUSED(d1);
-    ARG_UNUSED(d2);
-    while (true) {
-        // wait until a blink item is received and process it
-        struct blink_item blink;
-        k_msgq_get(&batt_led_msgq, &blink, K_FOREVER);
-        LOG_DBG("Got a blink item from msgq");
 
-        led_do_blink(blink);
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_LAYER_CHANGE)
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL) || !IS_ENABLED(CONFIG_ZMK_SPLIT) || \
+    IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_RELAY)
+static const struct zmk_indicator_led_pattern layer_patterns[] = {
+    BLINK_PATTERN(CONFIG_INDICATOR_LED_LAYER_PATTERN),
+};
 
-        // wait interval before processing another blink sequence
-        k_sleep(K_MSEC(CONFIG_INDICATOR_LED_INTERVAL_MS));
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL) || !IS_ENABLED(CONFIG_ZMK_SPLIT)
+static bool classify_layer(const zmk_event_t *eh, struct batt_led_indication *ind) {
+    // // ignore layer off events
+    // if (!as_zmk_layer_state_changed(eh)->state) {
+    //     return false;
+    // }
+
+    uint8_t highest_layer = zmk_keymap_highest_layer_active();
+    LOG_INF("Changed to layer %d", highest_layer + 1);
+    ind->pattern = 0;
+    ind->n_repeats = highest_layer + 1;
+    ind->flags = BLINK_FLAG_INDEX;
+    ind->key = highest_layer;
+    if (highest_layer >= batt_led_cfg.layer_persistence_threshold) {
+        ind->flags |= BLINK_FLAG_HOLD;
     }
+    return true;
 }
 
-// define batt_led_process_thread with stack size 1024, start running it 100 ms after boot
-K_THREAD_DEFINE(batt_led_process_tid, 1024, batt_led_process_thread, NULL, NULL, NULL, K_LOWEST_APPLICATION_THREAD_PRIO,
-                0, 100);
+BATT_LED_SOURCE_DEFINE(layer, BATT_LED_SOURCE_ID_LAYER, classify_layer, layer_patterns,
+                       BATT_LED_PRIO_LOW, BATT_LED_SOURCE_DEDUP | BATT_LED_SOURCE_RELAY);
+BATT_LED_SOURCE_LISTENER(layer);
+BATT_LED_SOURCE_SUBSCRIPTION(layer, zmk_layer_state_changed);
+#else
+// the keymap only lives on the central, peripherals just play what it relays
+BATT_LED_SOURCE_DEFINE(layer, BATT_LED_SOURCE_ID_LAYER, NULL, layer_patterns,
+                       BATT_LED_PRIO_LOW, BATT_LED_SOURCE_RELAY);
+#endif
+#endif
+#endif // IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_LAYER_CHANGE)
 
-extern void batt_led_init_thread(void *d0, void *d1, void *d2) {
-    ARG_UNUSED(d0);
-    ARG_UNUSED(d1);
-    ARG_UNUSED(d2);
+
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_RETAINED_STATE)
+// a single blink, for a reset after which no boot indication has anything new to show
+static const uint16_t boot_unchanged_steps[] = {60};
+static const struct zmk_indicator_led_pattern boot_unchanged_pattern =
+    BLINK_PATTERN(boot_unchanged_steps);
+#endif
+
+static void boot_timer_expiry(struct batt_led_timer *timer) {
+    atomic_set(&lifecycle, BATT_LED_BOOT_INDICATING);
 
 #if IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING) && \
     IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT)
-    indicate_startup_battery();
+    if (!indicate_startup_battery()) {
+        return;
+    }
 #endif // IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING)
 
 #if IS_ENABLED(CONFIG_ZMK_BLE) && IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BLE)
     // check and indicate current profile or peripheral connectivity status
     LOG_INF("Indicating initial connectivity status");
-    indicate_ble();
+    batt_led_source_show(&batt_led_source_ble, NULL);
 #endif // IS_ENABLED(CONFIG_ZMK_BLE)
 
-    initialized = true;
+#if IS_ENABLED(CONFIG_INDICATOR_LED_RETAINED_STATE)
+    if (batt_led_retained_unchanged()) {
+        LOG_INF("Nothing changed since before the reset, acknowledging with a single blink");
+        struct blink_item blink = {
+            .pattern = &boot_unchanged_pattern,
+            .source = BATT_LED_SOURCE_ID_BATTERY_BOOT,
+            .n_repeats = 1,
+            .priority = BATT_LED_PRIO_HIGH,
+        };
+        batt_led_enqueue(&blink);
+    }
+#endif
+
+    atomic_set(&lifecycle, BATT_LED_READY);
+    replay_pending_sources();
+#if IS_ENABLED(CONFIG_ZMK_BATTERY_REPORTING) && \
+    IS_ENABLED(CONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT) && \
+    IS_ENABLED(CONFIG_INDICATOR_LED_PERIPHERAL_BATTERY_PER_HALF)
+    // peripherals that reported while the boot indications were queued
+    battery_boot_show_halves();
+#endif
     LOG_INF("Finished initializing BATT LED widget");
 }
 
-// run init thread on boot for initial battery+output checks
-K_THREAD_DEFINE(batt_led_init_tid, 1024, batt_led_init_thread, NULL, NULL, NULL, K_LOWEST_APPLICATION_THREAD_PRIO,
-                0, 200);
+static int batt_led_init(void) {
+#if IS_ENABLED(CONFIG_INDICATOR_LED_RETAINED_STATE)
+    batt_led_retained_restore();
+#endif
+    // initial battery+output checks, 200 ms after boot
+    batt_led_timer_start(&boot_timer, 200);
+    return 0;
+}
+
+SYS_INIT(batt_led_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#endif // IS_ENABLED(CONFIG_INDICATOR_LED_PLAYER)
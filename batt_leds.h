@@ -0,0 +1,325 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/iterable_sections.h>
+
+#include <zmk/event_manager.h>
+
+#include <zmk_indicator_led.h>
+
+#define LENGTH(x)  (sizeof(x) / sizeof((x)[0]))
+
+// named tracing events, to line the indicator up with other threads in a CTF trace
+#if IS_ENABLED(CONFIG_INDICATOR_LED_TRACING)
+#include <zephyr/tracing/tracing.h>
+#define BATT_LED_TRACE(event, arg0, arg1) sys_trace_named_event("batt_led_" event, arg0, arg1)
+#else
+#define BATT_LED_TRACE(event, arg0, arg1)
+#endif
+
+// thresholds and counts that can be tuned at runtime, see batt_leds_config.c
+struct batt_led_config {
+    uint16_t interval_ms;
+    uint8_t battery_level_high;
+    uint8_t battery_level_low;
+    uint8_t battery_level_critical;
+    uint8_t battery_high_blink_repeat;
+    uint8_t battery_low_blink_repeat;
+    uint8_t battery_critical_blink_repeat;
+    uint8_t layer_persistence_threshold;
+};
+
+#define BATT_LED_CONFIG_DEFAULTS \
+    { \
+        .interval_ms = CONFIG_INDICATOR_LED_INTERVAL_MS, \
+        .battery_level_high = CONFIG_INDICATOR_LED_BATTERY_LEVEL_HIGH, \
+        .battery_level_low = CONFIG_INDICATOR_LED_BATTERY_LEVEL_LOW, \
+        .battery_level_critical = CONFIG_INDICATOR_LED_BATTERY_LEVEL_CRITICAL, \
+        .battery_high_blink_repeat = CONFIG_INDICATOR_LED_BATTERY_HIGH_BLINK_REPEAT, \
+        .battery_low_blink_repeat = CONFIG_INDICATOR_LED_BATTERY_LOW_BLINK_REPEAT, \
+        .battery_critical_blink_repeat = CONFIG_INDICATOR_LED_BATTERY_CRITICAL_BLINK_REPEAT, \
+        .layer_persistence_threshold = CONFIG_INDICATOR_LED_LAYER_PERSISTENCE_THRESHOLD, \
+    }
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_RUNTIME_CONFIG)
+extern struct batt_led_config batt_led_cfg;
+
+// validate and apply a new configuration, persisting it after the settings save debounce
+int batt_led_config_update(const struct batt_led_config *cfg);
+
+// change a single value by its field name in struct batt_led_config, as batt_led_config_update;
+// -ENOENT for an unknown name, -EINVAL if the value does not fit or is out of range
+int batt_led_config_set(const char *name, uint32_t value);
+
+// name and value of the i-th field, -ENOENT past the last one
+int batt_led_config_get(size_t i, const char **name, uint32_t *value);
+#else
+// without runtime configuration, every use folds into a constant
+static const struct batt_led_config batt_led_cfg = BATT_LED_CONFIG_DEFAULTS;
+#endif
+
+// a timer on the module's shared timer wheel, see batt_leds_timer.c
+struct batt_led_timer {
+    struct batt_led_timer *next;
+    struct batt_led_timer **pprev;
+    void (*expiry)(struct batt_led_timer *timer);
+    uint64_t expires;
+    uint8_t level;
+    uint8_t slot;
+};
+
+#define BATT_LED_TIMER_INITIALIZER(_expiry) \
+    { \
+        .expiry = _expiry \
+    }
+
+// (re)start a timer for an absolute uptime in ms; expiry callbacks run on the timer thread
+void batt_led_timer_start(struct batt_led_timer *timer, int64_t deadline_ms);
+void batt_led_timer_start_in(struct batt_led_timer *timer, uint32_t delay_ms);
+void batt_led_timer_cancel(struct batt_led_timer *timer);
+bool batt_led_timer_is_pending(const struct batt_led_timer *timer);
+
+// number of times the timer thread has woken up
+uint32_t batt_led_timer_wakeups(void);
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_STACK_ANALYSIS)
+// peak stack usage of the timer thread so far, in bytes, as of its last wakeup
+size_t batt_led_timer_stack_peak(void);
+#endif
+
+// LED compositor, see batt_leds.c; callable from any thread or ISR
+
+// change which owners hold the background layer lit, by bit: source ids and host indicators
+void batt_led_background_update(uint32_t clear, uint32_t set);
+
+// set the blink player's foreground layer, blended over the background while active
+void batt_led_foreground_update(bool active, uint8_t level);
+
+// brightness the LED is driven at, and whether the background is lit
+void batt_led_compositor_state(uint8_t *level, bool *background);
+
+#define BLINK_PATTERN(seq) ZMK_INDICATOR_LED_PATTERN(seq)
+
+// keep the LED lit as background state after the sequence, until the source's next sequence
+#define BLINK_FLAG_HOLD ZMK_INDICATOR_LED_FLAG_HOLD
+// n_repeats is a layer or profile number, blinked as configured by INDICATOR_LED_INDEX_ENCODING
+#define BLINK_FLAG_INDEX ZMK_INDICATOR_LED_FLAG_INDEX
+// with a compact index encoding, play the pattern once before the number as it carries state
+#define BLINK_FLAG_INDEX_HEADER BIT(2)
+// a later part of a composite boot sequence: starts right after the battery part before it, and
+// blinks its number compactly whatever INDICATOR_LED_INDEX_ENCODING is
+#define BLINK_FLAG_CHAIN BIT(3)
+
+// a blink work item, as queued for the player
+struct blink_item {
+    const struct zmk_indicator_led_pattern *pattern;
+    // stable id of the source, see enum batt_led_source_id
+    uint8_t source;
+    uint8_t n_repeats;
+    uint8_t priority;
+    uint8_t flags;
+    // the source's cancel generation when queued, items of an older one are dropped
+    uint8_t generation;
+    // uptime in ms at which the sequence should start, right away once it has passed; 0 to start
+    // after the interval and pre-roll instead
+    uint32_t start;
+};
+
+// stable source ids, the same on both halves of a split so that indications can be relayed;
+// ids from ZMK_INDICATOR_LED_SOURCE_USER on are left to other modules
+enum batt_led_source_id {
+    BATT_LED_SOURCE_ID_BATTERY_BOOT,
+    BATT_LED_SOURCE_ID_BATTERY_CRITICAL,
+    BATT_LED_SOURCE_ID_BLE,
+    BATT_LED_SOURCE_ID_LAYER,
+    BATT_LED_SOURCE_ID_BATTERY_RUNTIME,
+    // patterns played from the shell
+    BATT_LED_SOURCE_ID_SHELL = ZMK_INDICATOR_LED_SOURCE_USER - 1,
+};
+
+// walks the LED edges of a blink item, one step at a time
+struct blink_cursor {
+    struct blink_item blink;
+    uint8_t pattern_repeats;
+    uint8_t repeat;
+    uint16_t step;
+    // index digits still to play, most significant at bit (n_digits - 1); set bits are long pulses
+    uint8_t n_digits;
+    uint16_t digits;
+};
+
+void blink_cursor_init(struct blink_cursor *cursor, const struct blink_item *blink);
+
+// LED brightness of a lit step, in percent
+#define BLINK_LEVEL_FULL 100
+
+// get the next LED brightness and how long it lasts, false once the sequence is done
+bool blink_cursor_next(struct blink_cursor *cursor, uint8_t *level, uint16_t *duration_ms);
+
+// total time a blink item keeps the LED busy, excluding the gaps around it
+uint32_t blink_item_duration_ms(const struct blink_item *blink);
+
+// LED off time before each sequence, so that it stands apart from a held LED
+#define BLINK_PREROLL_MS 200
+
+// durations scale factor of 1, in the 1/256 steps used for speeding up a backlog
+#define BLINK_SCALE_ONE 256
+
+enum batt_led_priority {
+    BATT_LED_PRIO_LOW = ZMK_INDICATOR_LED_PRIO_LOW,
+    BATT_LED_PRIO_NORMAL = ZMK_INDICATOR_LED_PRIO_NORMAL,
+    BATT_LED_PRIO_HIGH = ZMK_INDICATOR_LED_PRIO_HIGH,
+    BATT_LED_PRIO_CRITICAL = ZMK_INDICATOR_LED_PRIO_CRITICAL,
+};
+
+// what a source wants to show for a single event
+struct batt_led_indication {
+    // index into the source's pattern table
+    uint8_t pattern;
+    uint8_t n_repeats;
+    uint8_t flags;
+    // identifies the state being shown; consecutive equal keys are dropped for dedup sources
+    uint32_t key;
+};
+
+// drop an indication if its key equals the previous one from the same source
+#define BATT_LED_SOURCE_DEDUP BIT(0)
+// also show the source's indications on split peripherals (see batt_leds_relay.c)
+#define BATT_LED_SOURCE_RELAY BIT(1)
+// keep the last shown key across warm resets (see batt_leds_retained.c); for dedup sources
+#define BATT_LED_SOURCE_RETAIN BIT(2)
+
+struct batt_led_source_state {
+    uint32_t last_key;
+    bool has_key;
+};
+
+/*
+ * An indication source. Each one classifies its events (or the current state, when called
+ * with a NULL event at boot) into a pattern from its own table. Sources that only play
+ * relayed indications have no classifier.
+ */
+struct batt_led_source {
+    const char *name;
+    uint8_t id;
+    bool (*classify)(const zmk_event_t *eh, struct batt_led_indication *ind);
+    const struct zmk_indicator_led_pattern *patterns;
+    uint8_t pattern_count;
+    uint8_t priority;
+    uint8_t flags;
+    struct batt_led_source_state *state;
+};
+
+#define BATT_LED_SOURCE_DEFINE(_name, _id, _classify, _patterns, _priority, _flags) \
+    static struct batt_led_source_state batt_led_source_state_##_name; \
+    const STRUCT_SECTION_ITERABLE(batt_led_source, batt_led_source_##_name) = { \
+        .name = #_name, \
+        .id = _id, \
+        .classify = _classify, \
+        .patterns = _patterns, \
+        .pattern_count = LENGTH(_patterns), \
+        .priority = _priority, \
+        .flags = _flags, \
+        .state = &batt_led_source_state_##_name, \
+    }
+
+// route events straight to a source; the dispatcher does not need to search for it
+#define BATT_LED_SOURCE_LISTENER(_name) \
+    static int batt_led_##_name##_listener_cb(const zmk_event_t *eh) { \
+        return batt_led_source_event(&batt_led_source_##_name, eh); \
+    } \
+    ZMK_LISTENER(batt_led_##_name##_listener, batt_led_##_name##_listener_cb)
+
+#define BATT_LED_SOURCE_SUBSCRIPTION(_name, _event) \
+    ZMK_SUBSCRIPTION(batt_led_##_name##_listener, _event)
+
+// index of a source inside the registry section, as carried by blink items
+static inline uint8_t batt_led_source_index(const struct batt_led_source *src) {
+    STRUCT_SECTION_START_EXTERN(batt_led_source);
+    return src - STRUCT_SECTION_START(batt_led_source);
+}
+
+// classify and queue an indication from an event; during boot, the source's current state is
+// shown once after the boot indications instead
+int batt_led_source_event(const struct batt_led_source *src, const zmk_event_t *eh);
+
+// classify and queue an indication for the current state of a source
+int batt_led_source_show(const struct batt_led_source *src, const zmk_event_t *eh);
+
+// look up a source by its stable id, NULL if it is not built in
+const struct batt_led_source *batt_led_source_find(uint8_t id);
+
+// queue a blink item for the player (see batt_leds_player.c), waking it up if it is idle;
+// -ENOMSG if the queue is full
+int batt_led_enqueue(const struct blink_item *blink);
+
+// blink items waiting for the player, see batt_leds_queue.c
+#define BATT_LED_QUEUE_DEPTH 6
+
+// queue an item as the overflow policy allows, -ENOMSG if it was dropped
+int batt_led_queue_put(const struct blink_item *blink);
+
+// take the oldest item, -ENOMSG if the queue is empty
+int batt_led_queue_get(struct blink_item *blink);
+
+// copy the i-th oldest item, -ENOMSG if there are not that many
+int batt_led_queue_peek_at(uint32_t i, struct blink_item *blink);
+
+uint32_t batt_led_queue_count(void);
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHELL)
+struct batt_led_player_status {
+    struct blink_item blink;
+    uint8_t repeat;
+    uint16_t step;
+    // time until the sequence ends, in ms
+    uint32_t remaining_ms;
+};
+
+// what the player is doing, false when idle; a consistent snapshot for diagnostics, taken under
+// the player's lock, which the player may move on from right after
+bool batt_led_player_status(struct batt_led_player_status *status);
+#endif
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BATTERY_HISTORY)
+struct batt_led_history_sample {
+    uint32_t age_s;
+    uint8_t level;
+};
+
+// record a battery level, see batt_leds_history.c
+void batt_led_history_add(uint8_t level);
+
+size_t batt_led_history_count(void);
+
+// get a recorded sample, 0 being the newest
+int batt_led_history_get(size_t i, struct batt_led_history_sample *sample);
+
+// estimate the minutes until the battery is empty, -EAGAIN while the history is too short
+int batt_led_history_time_to_empty(uint32_t *minutes);
+#endif
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_RETAINED_STATE)
+// restore the last shown keys of retaining sources from before a reset, if there is a valid copy
+void batt_led_retained_restore(void);
+
+// record the key a retaining source has shown
+void batt_led_retained_save(uint8_t id, uint32_t key);
+
+// true if the retained state was restored and no retaining source has shown anything new since
+bool batt_led_retained_unchanged(void);
+#endif
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_RELAY)
+// send an indication queued on the central to the peripherals as well
+void batt_led_relay_push(const struct batt_led_source *src, const struct blink_item *blink);
+
+// play the indications of a frame received from the central
+int batt_led_relay_receive(const uint8_t *buf, size_t len);
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_SYNC)
+// delay a peripheral waits after receiving a frame, so that it starts playing together with the
+// central; accounts for the write waiting for the next connection event
+uint16_t batt_led_relay_sync_delay_ms(uint32_t conn_interval_ms);
+#endif
+#endif
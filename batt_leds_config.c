@@ -0,0 +1,163 @@
+/*
+ * Runtime copy of the indicator thresholds and counts, persisted through the settings
+ * subsystem. The whole struct is stored as one record, read during ZMK's settings load and
+ * written back after CONFIG_ZMK_SETTINGS_SAVE_DEBOUNCE, only if it differs from what is
+ * already stored. The debounce runs on the module's timer wheel, the flash write itself on the
+ * system work queue. Single values are changed by name, e.g. from the "indicator config" shell
+ * command.
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define BATT_LED_SETTINGS_KEY "indicator_led/config"
+
+struct batt_led_config batt_led_cfg = BATT_LED_CONFIG_DEFAULTS;
+
+// last configuration written to (or read from) flash
+static struct batt_led_config batt_led_cfg_stored = BATT_LED_CONFIG_DEFAULTS;
+
+// the values by name, for changing them one at a time
+struct config_field {
+    const char *name;
+    uint8_t offset;
+    uint8_t size;
+};
+
+#define CONFIG_FIELD(_name) \
+    { \
+        .name = #_name, \
+        .offset = offsetof(struct batt_led_config, _name), \
+        .size = sizeof(((struct batt_led_config *)0)->_name), \
+    }
+
+static const struct config_field config_fields[] = {
+    CONFIG_FIELD(interval_ms),
+    CONFIG_FIELD(battery_level_high),
+    CONFIG_FIELD(battery_level_low),
+    CONFIG_FIELD(battery_level_critical),
+    CONFIG_FIELD(battery_high_blink_repeat),
+    CONFIG_FIELD(battery_low_blink_repeat),
+    CONFIG_FIELD(battery_critical_blink_repeat),
+    CONFIG_FIELD(layer_persistence_threshold),
+};
+
+static bool config_is_valid(const struct batt_led_config *cfg) {
+    return cfg->battery_level_high <= 100 &&
+           cfg->battery_level_critical <= cfg->battery_level_low &&
+           cfg->battery_level_low <= cfg->battery_level_high;
+}
+
+static void config_save_work_cb(struct k_work *work) {
+    struct batt_led_config cfg = batt_led_cfg;
+
+    if (memcmp(&cfg, &batt_led_cfg_stored, sizeof(cfg)) == 0) {
+        LOG_DBG("Indicator config unchanged, not writing settings");
+        return;
+    }
+
+    int err = settings_save_one(BATT_LED_SETTINGS_KEY, &cfg, sizeof(cfg));
+    if (err < 0) {
+        LOG_ERR("Failed to save indicator config (err %d)", err);
+        return;
+    }
+    batt_led_cfg_stored = cfg;
+}
+
+static K_WORK_DEFINE(config_save_work, config_save_work_cb);
+
+static void config_save_timer_expiry(struct batt_led_timer *timer) {
+    k_work_submit(&config_save_work);
+}
+
+static struct batt_led_timer config_save_timer = BATT_LED_TIMER_INITIALIZER(config_save_timer_expiry);
+
+int batt_led_config_update(const struct batt_led_config *cfg) {
+    if (!config_is_valid(cfg)) {
+        return -EINVAL;
+    }
+
+    batt_led_cfg = *cfg;
+    batt_led_timer_start_in(&config_save_timer, CONFIG_ZMK_SETTINGS_SAVE_DEBOUNCE);
+    return 0;
+}
+
+int batt_led_config_set(const char *name, uint32_t value) {
+    for (size_t i = 0; i < ARRAY_SIZE(config_fields); i++) {
+        const struct config_field *field = &config_fields[i];
+        if (strcmp(field->name, name) != 0) {
+            continue;
+        }
+
+        struct batt_led_config cfg = batt_led_cfg;
+        uint8_t *dst = (uint8_t *)&cfg + field->offset;
+        if (field->size == sizeof(uint8_t) && value <= UINT8_MAX) {
+            *dst = value;
+        } else if (field->size == sizeof(uint16_t) && value <= UINT16_MAX) {
+            uint16_t value16 = value;
+            memcpy(dst, &value16, sizeof(value16));
+        } else {
+            return -EINVAL;
+        }
+        return batt_led_config_update(&cfg);
+    }
+    return -ENOENT;
+}
+
+int batt_led_config_get(size_t i, const char **name, uint32_t *value) {
+    if (i >= ARRAY_SIZE(config_fields)) {
+        return -ENOENT;
+    }
+
+    const struct config_field *field = &config_fields[i];
+    const uint8_t *src = (const uint8_t *)&batt_led_cfg + field->offset;
+    *name = field->name;
+    if (field->size == sizeof(uint8_t)) {
+        *value = *src;
+    } else {
+        uint16_t value16;
+        memcpy(&value16, src, sizeof(value16));
+        *value = value16;
+    }
+    return 0;
+}
+
+static int config_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                               void *cb_arg) {
+    const char *next;
+    if (!settings_name_steq(name, "config", &next) || next != NULL) {
+        return -ENOENT;
+    }
+
+    struct batt_led_config cfg;
+    if (len != sizeof(cfg)) {
+        // stored by a build with a different layout, keep the Kconfig defaults
+        LOG_WRN("Ignoring stored indicator config of unexpected size %zu", len);
+        return 0;
+    }
+
+    int err = read_cb(cb_arg, &cfg, sizeof(cfg));
+    if (err < 0) {
+        LOG_ERR("Failed to read indicator config (err %d)", err);
+        return err;
+    }
+    if (!config_is_valid(&cfg)) {
+        LOG_WRN("Ignoring invalid stored indicator config");
+        return 0;
+    }
+
+    batt_led_cfg = cfg;
+    batt_led_cfg_stored = cfg;
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(indicator_led, "indicator_led", NULL, config_settings_set, NULL,
+                               NULL);
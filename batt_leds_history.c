@@ -0,0 +1,133 @@
+/*
+ * History of battery levels, and a time-to-empty estimate fitted to it.
+ *
+ * A sample is recorded whenever the level changes, or when the time since the previous sample
+ * would no longer fit its 16-bit delta in seconds (about 18 hours). Each sample is the delta
+ * plus the level, 3 bytes, so the ring covers the last 40 level changes in 120 bytes. A rising
+ * level means the battery is charging, which starts a new history.
+ *
+ * The discharge rate is a least-squares line through the samples, in integer arithmetic with
+ * minutes on the time axis so that the sums of a full ring fit into 64 bits.
+ */
+
+#include <zephyr/kernel.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define HISTORY_LEN 40
+// fewer samples than this do not give a useful rate for integer percentages
+#define HISTORY_MIN_SAMPLES 4
+
+static struct {
+    // seconds since the previous sample, saturating
+    uint16_t delta_s[HISTORY_LEN];
+    uint8_t level[HISTORY_LEN];
+    // index of the newest sample
+    uint8_t head;
+    uint8_t count;
+    // uptime of the newest sample, in s
+    uint32_t last_s;
+} history;
+
+static struct k_spinlock history_lock;
+
+static uint8_t history_index(size_t i) {
+    return (history.head + HISTORY_LEN - i) % HISTORY_LEN;
+}
+
+void batt_led_history_add(uint8_t level) {
+    uint32_t now_s = k_uptime_get() / MSEC_PER_SEC;
+
+    if (level == 0) {
+        // level not determined yet
+        return;
+    }
+
+    K_SPINLOCK(&history_lock) {
+        uint32_t delta_s = now_s - history.last_s;
+
+        if (history.count > 0) {
+            uint8_t last = history.level[history.head];
+            if (level > last + 1) {
+                LOG_DBG("Battery level rose from %d to %d, restarting history", last, level);
+                history.count = 0;
+            } else if (level == last && delta_s < UINT16_MAX) {
+                K_SPINLOCK_BREAK;
+            }
+        }
+
+        history.head = (history.head + 1) % HISTORY_LEN;
+        history.delta_s[history.head] = history.count > 0 ? MIN(delta_s, UINT16_MAX) : 0;
+        history.level[history.head] = level;
+        history.count = MIN(history.count + 1, HISTORY_LEN);
+        history.last_s = now_s;
+    }
+}
+
+size_t batt_led_history_count(void) {
+    return history.count;
+}
+
+int batt_led_history_get(size_t i, struct batt_led_history_sample *sample) {
+    int err = -ENOENT;
+
+    K_SPINLOCK(&history_lock) {
+        if (i >= history.count) {
+            K_SPINLOCK_BREAK;
+        }
+
+        uint32_t age_s = k_uptime_get() / MSEC_PER_SEC - history.last_s;
+        for (size_t j = 0; j < i; j++) {
+            age_s += history.delta_s[history_index(j)];
+        }
+        sample->age_s = age_s;
+        sample->level = history.level[history_index(i)];
+        err = 0;
+    }
+    return err;
+}
+
+int batt_led_history_time_to_empty(uint32_t *minutes) {
+    int64_t sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+    int64_t n;
+
+    K_SPINLOCK(&history_lock) {
+        // x is minutes relative to the newest sample, so it is never positive
+        int64_t x_s = 0;
+        n = history.count;
+        for (size_t i = 0; i < n; i++) {
+            uint8_t idx = history_index(i);
+            int64_t x = x_s / 60;
+            int64_t y = history.level[idx];
+            sum_x += x;
+            sum_y += y;
+            sum_xx += x * x;
+            sum_xy += x * y;
+            x_s -= history.delta_s[idx];
+        }
+    }
+
+    if (n < HISTORY_MIN_SAMPLES) {
+        return -EAGAIN;
+    }
+
+    // slope = num / den in %/min, negative while discharging
+    int64_t num = n * sum_xy - sum_x * sum_y;
+    int64_t den = n * sum_xx - sum_x * sum_x;
+    if (den <= 0 || num >= 0) {
+        return -EAGAIN;
+    }
+
+    // level of the fitted line at the newest sample, over its slope
+    int64_t level_den = sum_y * den - num * sum_x;
+    if (level_den <= 0) {
+        *minutes = 0;
+        return 0;
+    }
+    *minutes = MIN(level_den / (n * -num), UINT32_MAX);
+    return 0;
+}
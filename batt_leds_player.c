@@ -0,0 +1,408 @@
+/*
+ * Blink player: walks queued blink items step by step on the timer wheel and drives the
+ * foreground layer of the LED compositor. Also implements the public API of
+ * include/zmk_indicator_led.h, which queues items for it.
+ *
+ * Only built when something can queue a blink sequence (INDICATOR_LED_PLAYER), together with
+ * the timer wheel and the queue.
+ */
+
+#include <zephyr/kernel.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+static void led_set(uint8_t level) {
+    batt_led_foreground_update(true, level);
+}
+
+// number blinked as short and long pulses rather than by repeating the pattern
+static bool blink_index_compact(const struct blink_item *blink) {
+    if (!(blink->flags & BLINK_FLAG_INDEX)) {
+        return false;
+    }
+    return IS_ENABLED(CONFIG_INDICATOR_LED_INDEX_ENCODING_BINARY) ||
+           (IS_ENABLED(CONFIG_INDICATOR_LED_BOOT_COMPOSITE) && (blink->flags & BLINK_FLAG_CHAIN));
+}
+
+void blink_cursor_init(struct blink_cursor *cursor, const struct blink_item *blink) {
+    *cursor = (struct blink_cursor){.blink = *blink};
+
+    if (!blink_index_compact(blink)) {
+        cursor->pattern_repeats = blink->n_repeats;
+    } else {
+        // bijective base 2: digits are 1 (short) or 2 (long), so n takes about log2(n) pulses
+        for (uint8_t n = blink->n_repeats; n > 0; n = (n - 1) / 2) {
+            cursor->digits |= (n % 2 == 0) << cursor->n_digits;
+            cursor->n_digits++;
+        }
+        cursor->pattern_repeats = (blink->flags & BLINK_FLAG_INDEX_HEADER) ? 1 : 0;
+    }
+
+    if (blink->pattern->sequence_len == 0) {
+        cursor->pattern_repeats = 0;
+    }
+}
+
+// 1.0 in the Q15 fixed point used by the generators
+#define BLINK_Q15_ONE BIT(15)
+
+// smoothstep 3x^2 - 2x^3 in percent, sampled at x = i / BLINK_FADE_MAX; within about 1% of a
+// raised cosine, without any runtime math
+#define BLINK_FADE_MAX (CONFIG_INDICATOR_LED_FADE_RESOLUTION - 1)
+#define BLINK_FADE_CUBE ((uint64_t)BLINK_FADE_MAX * BLINK_FADE_MAX * BLINK_FADE_MAX)
+#define BLINK_FADE_ENTRY(i, _) \
+    ((100ULL * (i) * (i) * (3 * BLINK_FADE_MAX - 2 * (i)) + BLINK_FADE_CUBE / 2) / BLINK_FADE_CUBE)
+
+static const uint8_t blink_fade[] = {
+    LISTIFY(CONFIG_INDICATOR_LED_FADE_RESOLUTION, BLINK_FADE_ENTRY, (,))};
+
+// compute a step of a generator pattern; O(1) and integer only, so that generators cost no
+// more per step than reading a sequence array
+static void blink_generate(const struct zmk_indicator_led_pattern *pattern, uint16_t step,
+                           uint8_t *level, uint16_t *duration_ms) {
+    uint32_t n_steps = pattern->sequence_len;
+
+    switch (pattern->generator) {
+    case ZMK_INDICATOR_LED_GEN_BREATHE: {
+        // triangle from 0 to 1 and back over the period, sampled at the middle of each step
+        uint32_t x = (2 * step + 1) * BLINK_Q15_ONE / n_steps;
+        if (x > BLINK_Q15_ONE) {
+            x = 2 * BLINK_Q15_ONE - x;
+        }
+        // eased by the fade curve, a single table load
+        *level = blink_fade[(x * BLINK_FADE_MAX + BLINK_Q15_ONE / 2) >> 15];
+        *duration_ms = MAX(pattern->period_ms / n_steps, 1);
+        break;
+    }
+    case ZMK_INDICATOR_LED_GEN_CHIRP: {
+        // period interpolated linearly by pulse; with at most 32767 pulses, fits in 32 bits
+        int32_t n_pulses = n_steps / 2;
+        int32_t period = pattern->period_ms;
+        if (n_pulses > 1) {
+            period += ((int32_t)pattern->end_period_ms - period) * (step / 2) / (n_pulses - 1);
+        }
+        // on for the first half of each period
+        *level = step % 2 == 0 ? BLINK_LEVEL_FULL : 0;
+        *duration_ms = MAX(step % 2 == 0 ? period / 2 : period - period / 2, 1);
+        break;
+    }
+    default:
+        // on for evens (0 == start, off for odds. If the sequence contains an odd number, will stay on.
+        *level = step % 2 == 0 ? BLINK_LEVEL_FULL : 0;
+        *duration_ms = pattern->sequence[step];
+        break;
+    }
+}
+
+bool blink_cursor_next(struct blink_cursor *cursor, uint8_t *level, uint16_t *duration_ms) {
+    const struct zmk_indicator_led_pattern *pattern = cursor->blink.pattern;
+
+    if (cursor->repeat < cursor->pattern_repeats) {
+        blink_generate(pattern, cursor->step, level, duration_ms);
+        // >= rather than ==, so that a walk ends even from a step past the end of the pattern
+        if (++cursor->step >= pattern->sequence_len) {
+            cursor->step = 0;
+            cursor->repeat++;
+        }
+        return true;
+    }
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_INDEX_ENCODING_BINARY) || \
+    IS_ENABLED(CONFIG_INDICATOR_LED_BOOT_COMPOSITE)
+    if (cursor->n_digits > 0) {
+        // a pulse for the digit, then a gap before the next one
+        if (cursor->step == 0) {
+            bool long_pulse = cursor->digits & BIT(cursor->n_digits - 1);
+            *level = BLINK_LEVEL_FULL;
+            *duration_ms = long_pulse ? CONFIG_INDICATOR_LED_INDEX_LONG_MS
+                                      : CONFIG_INDICATOR_LED_INDEX_SHORT_MS;
+            cursor->step = 1;
+        } else {
+            *level = 0;
+            *duration_ms = CONFIG_INDICATOR_LED_INDEX_GAP_MS;
+            cursor->step = 0;
+            cursor->n_digits--;
+        }
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+uint32_t blink_item_duration_ms(const struct blink_item *blink) {
+    struct blink_cursor cursor;
+    uint8_t level;
+    uint16_t duration_ms;
+    uint32_t total = 0;
+
+    blink_cursor_init(&cursor, blink);
+    while (blink_cursor_next(&cursor, &level, &duration_ms)) {
+        total += duration_ms;
+    }
+    return total;
+}
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BACKLOG_COMPRESSION)
+// factor (in 1/256) that fits everything queued into the backlog budget
+static uint16_t backlog_scale(const struct blink_item *current) {
+    uint32_t pending = blink_item_duration_ms(current);
+    uint32_t n_queued = batt_led_queue_count();
+
+    for (uint32_t i = 0; i < n_queued; i++) {
+        struct blink_item queued;
+        if (batt_led_queue_peek_at(i, &queued) == 0) {
+            pending += BLINK_PREROLL_MS + batt_led_cfg.interval_ms + blink_item_duration_ms(&queued);
+        }
+    }
+
+    if (pending <= CONFIG_INDICATOR_LED_BACKLOG_BUDGET_MS) {
+        return BLINK_SCALE_ONE;
+    }
+    LOG_DBG("%u ms of blinks pending, speeding up", pending);
+    return (uint64_t)CONFIG_INDICATOR_LED_BACKLOG_BUDGET_MS * BLINK_SCALE_ONE / pending;
+}
+
+static uint16_t scale_duration(uint16_t duration_ms, uint16_t scale) {
+    if (scale >= BLINK_SCALE_ONE || duration_ms <= CONFIG_INDICATOR_LED_MIN_STEP_MS) {
+        return duration_ms;
+    }
+    // steps never get shorter than can be read
+    return MAX((uint32_t)duration_ms * scale / BLINK_SCALE_ONE, CONFIG_INDICATOR_LED_MIN_STEP_MS);
+}
+#else
+static inline uint16_t backlog_scale(const struct blink_item *current) {
+    return BLINK_SCALE_ONE;
+}
+
+static inline uint16_t scale_duration(uint16_t duration_ms, uint16_t scale) {
+    return duration_ms;
+}
+#endif
+
+enum player_phase {
+    PLAYER_IDLE,
+    PLAYER_PREROLL,
+    PLAYER_PLAYING,
+};
+
+static void player_timer_expiry(struct batt_led_timer *timer);
+
+// the sequence being played; only changed from the timer thread, with player_lock held for the
+// cursor and timing that batt_led_player_status reads from other threads
+static struct k_spinlock player_lock;
+static struct {
+    struct batt_led_timer timer;
+    struct blink_cursor cursor;
+    enum player_phase phase;
+    uint16_t scale;
+    // end of the current step
+    int64_t deadline;
+    // end of the previous sequence
+    int64_t last_end;
+    uint32_t wakeups;
+} player = {.timer = BATT_LED_TIMER_INITIALIZER(player_timer_expiry)};
+
+// set while the player waits for an item, cleared by whoever wakes it up
+static atomic_t player_idle = ATOMIC_INIT(1);
+
+// id of the source being played, -1 if none; for querying from other threads
+static atomic_t player_source = ATOMIC_INIT(-1);
+
+// bumped by cancelling a source, which drops its items queued with an older generation
+static atomic_t source_generations[ZMK_INDICATOR_LED_SOURCE_ID_MAX];
+
+static bool blink_item_cancelled(const struct blink_item *blink) {
+    return blink->generation != (uint8_t)atomic_get(&source_generations[blink->source]);
+}
+
+// previous: the sequence that just ended, NULL when the player was idle
+static void player_start_next(const struct blink_item *previous) {
+    struct blink_item blink;
+    do {
+        if (batt_led_queue_get(&blink) != 0) {
+            player.phase = PLAYER_IDLE;
+            atomic_set(&player_source, -1);
+            atomic_set(&player_idle, 1);
+            // an item queued just before going idle did not wake the player, pick it up now
+            if (batt_led_queue_count() > 0 && atomic_cas(&player_idle, 1, 0)) {
+                batt_led_timer_start(&player.timer, k_uptime_get());
+            }
+            return;
+        }
+    } while (blink_item_cancelled(&blink));
+    LOG_DBG("Got a blink item from the queue");
+    BATT_LED_TRACE("queue_get", blink.source, batt_led_queue_count());
+
+    // wait interval after the previous blink sequence, then the pre-roll; when the item was
+    // already queued, both are covered by a single timer
+    int64_t now = k_uptime_get();
+    uint16_t scale = backlog_scale(&blink);
+    uint16_t preroll = scale_duration(BLINK_PREROLL_MS, scale);
+    int64_t start = MAX(now + preroll,
+                        player.last_end + scale_duration(batt_led_cfg.interval_ms, scale) + preroll);
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BOOT_COMPOSITE)
+    if ((blink.flags & BLINK_FLAG_CHAIN) && previous != NULL &&
+        previous->source == BATT_LED_SOURCE_ID_BATTERY_BOOT) {
+        // the next part of one merged boot sequence, only a short separator apart; without the
+        // battery part right before it, it plays as a sequence of its own
+        start = MAX(now, player.last_end + CONFIG_INDICATOR_LED_BOOT_SEPARATOR_MS);
+    }
+#endif
+    if (blink.start != 0) {
+        // synchronized with the other half of a split, start at the agreed time, or right away
+        // when it has passed, without a pre-roll the other half does not have
+        start = now + MAX((int32_t)(blink.start - (uint32_t)now), 0);
+        // and keep the same pace as the other half
+        scale = BLINK_SCALE_ONE;
+    }
+
+    // the sequence takes over from its source's held state, starting with the pre-roll
+    batt_led_background_update(BIT(blink.source), 0);
+    batt_led_foreground_update(true, 0);
+    atomic_set(&player_source, blink.source);
+    K_SPINLOCK(&player_lock) {
+        blink_cursor_init(&player.cursor, &blink);
+        player.phase = PLAYER_PREROLL;
+        player.scale = scale;
+        player.deadline = start;
+    }
+    player.wakeups = batt_led_timer_wakeups();
+    batt_led_timer_start(&player.timer, start);
+}
+
+static void player_timer_expiry(struct batt_led_timer *timer) {
+    const struct blink_item *blink = &player.cursor.blink;
+    uint8_t level;
+    uint16_t duration_ms;
+
+    switch (player.phase) {
+    case PLAYER_IDLE:
+        player_start_next(NULL);
+        return;
+    case PLAYER_PREROLL:
+        BATT_LED_TRACE("seq_start", blink->source, blink->n_repeats);
+        player.phase = PLAYER_PLAYING;
+        break;
+    case PLAYER_PLAYING:
+        break;
+    }
+
+    bool cancelled = blink_item_cancelled(blink);
+    bool stepped = false;
+    K_SPINLOCK(&player_lock) {
+        stepped = !cancelled && blink_cursor_next(&player.cursor, &level, &duration_ms);
+        if (stepped) {
+            // absolute deadlines, so that time spent switching the LED does not add up
+            player.deadline += scale_duration(duration_ms, player.scale);
+        }
+    }
+    if (stepped) {
+        led_set(level);
+        batt_led_timer_start(&player.timer, player.deadline);
+        return;
+    }
+
+    batt_led_foreground_update(false, 0);
+    if ((blink->flags & BLINK_FLAG_HOLD) && !cancelled) {
+        batt_led_background_update(0, BIT(blink->source));
+    }
+    BATT_LED_TRACE("seq_end", blink->source, blink->n_repeats);
+    LOG_DBG("Blink sequence took %u wakeups", batt_led_timer_wakeups() - player.wakeups);
+    player.last_end = player.deadline;
+    player_start_next(blink);
+}
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SHELL)
+bool batt_led_player_status(struct batt_led_player_status *status) {
+    if (atomic_get(&player_source) < 0) {
+        return false;
+    }
+
+    struct blink_cursor cursor;
+    int64_t deadline;
+    uint16_t scale;
+    uint8_t level;
+    uint16_t duration_ms;
+
+    // a consistent snapshot, the timer thread may move on right after
+    K_SPINLOCK(&player_lock) {
+        cursor = player.cursor;
+        deadline = player.deadline;
+        scale = player.scale;
+    }
+
+    status->blink = cursor.blink;
+    status->repeat = cursor.repeat;
+    status->step = cursor.step;
+    status->remaining_ms = MAX(deadline - k_uptime_get(), 0);
+    // ends once the repeats and digits are used up, each repeat after sequence_len steps
+    while (blink_cursor_next(&cursor, &level, &duration_ms)) {
+        status->remaining_ms += scale_duration(duration_ms, scale);
+    }
+    return true;
+}
+#endif
+
+static void player_kick(void) {
+    if (atomic_cas(&player_idle, 1, 0)) {
+        batt_led_timer_start(&player.timer, k_uptime_get());
+    }
+}
+
+int batt_led_enqueue(const struct blink_item *blink) {
+    __ASSERT(blink->source < ZMK_INDICATOR_LED_SOURCE_ID_MAX, "Source id out of range");
+    struct blink_item item = *blink;
+    item.generation = atomic_get(&source_generations[blink->source]);
+
+    int err = batt_led_queue_put(&item);
+    BATT_LED_TRACE("queue_put", blink->source, err);
+    if (err == 0) {
+        player_kick();
+    }
+    return err;
+}
+
+
+int zmk_indicator_led_enqueue(uint8_t source_id, const struct zmk_indicator_led_pattern *pattern,
+                              uint8_t n_repeats, uint8_t priority, uint8_t flags) {
+    if (source_id >= ZMK_INDICATOR_LED_SOURCE_ID_MAX || pattern == NULL ||
+        pattern->sequence_len == 0 || n_repeats == 0 || priority > ZMK_INDICATOR_LED_PRIO_CRITICAL) {
+        return -EINVAL;
+    }
+    if (pattern->generator > ZMK_INDICATOR_LED_GEN_CHIRP || pattern->sequence_len > UINT16_MAX ||
+        (pattern->generator == ZMK_INDICATOR_LED_GEN_SEQUENCE && pattern->sequence == NULL)) {
+        return -EINVAL;
+    }
+
+    struct blink_item blink = {
+        .pattern = pattern,
+        .source = source_id,
+        .n_repeats = n_repeats,
+        .priority = priority,
+        .flags = flags & (ZMK_INDICATOR_LED_FLAG_HOLD | ZMK_INDICATOR_LED_FLAG_INDEX),
+    };
+    return batt_led_enqueue(&blink);
+}
+
+int zmk_indicator_led_cancel(uint8_t source_id) {
+    if (source_id >= ZMK_INDICATOR_LED_SOURCE_ID_MAX) {
+        return -EINVAL;
+    }
+
+    // queued items are dropped when they come up, a playing one at its next step
+    atomic_inc(&source_generations[source_id]);
+    batt_led_background_update(BIT(source_id), 0);
+    return 0;
+}
+
+void zmk_indicator_led_get_state(struct zmk_indicator_led_state *state) {
+    batt_led_compositor_state(&state->brightness, &state->background);
+    state->on = state->brightness > 0;
+    state->playing_source = atomic_get(&player_source);
+    state->queued = batt_led_queue_count();
+}
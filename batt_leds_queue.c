@@ -0,0 +1,130 @@
+/*
+ * Queue of blink items waiting for the player, with a configurable policy for when it is full:
+ *
+ * - drop newest: the new item is dropped
+ * - drop oldest: the oldest queued item makes room
+ * - replace same source: the newest queued item of the new item's source is replaced in place,
+ *   so the last one of the source to play is its newest state; otherwise the new item is dropped
+ * - drop lowest priority: the oldest of the lowest-priority items makes room, unless the new
+ *   item has an even lower priority, then it is dropped
+ *
+ * The queue is a ring of BATT_LED_QUEUE_DEPTH items under a spinlock. Every operation, eviction
+ * included, scans or shifts at most the whole ring once inside the lock.
+ */
+
+#include <zephyr/kernel.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+static struct {
+    struct blink_item items[BATT_LED_QUEUE_DEPTH];
+    // index of the oldest item
+    uint8_t head;
+    uint8_t count;
+} queue;
+
+static struct k_spinlock queue_lock;
+
+// i-th oldest item
+static struct blink_item *queue_at(uint8_t i) {
+    return &queue.items[(queue.head + i) % BATT_LED_QUEUE_DEPTH];
+}
+
+static void queue_remove_at(uint8_t i) {
+    for (; i + 1 < queue.count; i++) {
+        *queue_at(i) = *queue_at(i + 1);
+    }
+    queue.count--;
+}
+
+// the queued item to give up for a new one when the queue is full, -1 to drop the new one
+static int queue_victim(const struct blink_item *blink) {
+#if IS_ENABLED(CONFIG_INDICATOR_LED_QUEUE_DROP_OLDEST)
+    return 0;
+#elif IS_ENABLED(CONFIG_INDICATOR_LED_QUEUE_REPLACE_SAME_SOURCE)
+    for (int i = queue.count - 1; i >= 0; i--) {
+        if (queue_at(i)->source == blink->source) {
+            return i;
+        }
+    }
+    return -1;
+#elif IS_ENABLED(CONFIG_INDICATOR_LED_QUEUE_DROP_LOWEST_PRIORITY)
+    uint8_t lowest = 0;
+    for (uint8_t i = 1; i < queue.count; i++) {
+        if (queue_at(i)->priority < queue_at(lowest)->priority) {
+            lowest = i;
+        }
+    }
+    return queue_at(lowest)->priority > blink->priority ? -1 : lowest;
+#else
+    return -1;
+#endif
+}
+
+int batt_led_queue_put(const struct blink_item *blink) {
+    int err = 0;
+    int victim = -1;
+    uint8_t victim_source = 0;
+
+    K_SPINLOCK(&queue_lock) {
+        if (queue.count < BATT_LED_QUEUE_DEPTH) {
+            *queue_at(queue.count++) = *blink;
+            K_SPINLOCK_BREAK;
+        }
+
+        victim = queue_victim(blink);
+        if (victim < 0) {
+            err = -ENOMSG;
+            K_SPINLOCK_BREAK;
+        }
+
+        victim_source = queue_at(victim)->source;
+        if (IS_ENABLED(CONFIG_INDICATOR_LED_QUEUE_REPLACE_SAME_SOURCE)) {
+            // the newer state of the source takes the place of its newest queued one
+            *queue_at(victim) = *blink;
+        } else {
+            queue_remove_at(victim);
+            *queue_at(queue.count++) = *blink;
+        }
+    }
+
+    if (victim >= 0) {
+        LOG_DBG("Blink queue full, dropped a queued indication of source %d", victim_source);
+        BATT_LED_TRACE("queue_drop", victim_source, victim);
+    }
+    return err;
+}
+
+int batt_led_queue_get(struct blink_item *blink) {
+    int err = -ENOMSG;
+
+    K_SPINLOCK(&queue_lock) {
+        if (queue.count > 0) {
+            *blink = *queue_at(0);
+            queue.head = (queue.head + 1) % BATT_LED_QUEUE_DEPTH;
+            queue.count--;
+            err = 0;
+        }
+    }
+    return err;
+}
+
+int batt_led_queue_peek_at(uint32_t i, struct blink_item *blink) {
+    int err = -ENOMSG;
+
+    K_SPINLOCK(&queue_lock) {
+        if (i < queue.count) {
+            *blink = *queue_at(i);
+            err = 0;
+        }
+    }
+    return err;
+}
+
+uint32_t batt_led_queue_count(void) {
+    return queue.count;
+}
@@ -0,0 +1,282 @@
+/*
+ * Relays indications from the central half of a split to its peripherals.
+ *
+ * Only compact handles are sent, the peripheral has the same source and pattern tables and
+ * plays them itself. Handles queued within CONFIG_INDICATOR_LED_SPLIT_RELAY_BATCH_MS of each
+ * other go out as one frame: a count byte followed by 3 bytes per indication
+ *   [source id] [pattern index (low nibble) | blink flags (high nibble)] [repeats]
+ *
+ * With CONFIG_INDICATOR_LED_SPLIT_SYNC, the count byte is followed by a little-endian 16-bit
+ * delay in ms after which the peripheral starts playing the frame. The central plays the frame
+ * itself after CONFIG_INDICATOR_LED_SPLIT_SYNC_LEAD_MS, and shortens the delay it sends by the
+ * expected time until the write goes out, half a connection interval. Zephyr does not expose
+ * the connection event counter to the host, so this estimate is what bounds the skew.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define RELAY_HEADER_SIZE (IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_SYNC) ? 3 : 1)
+#define RELAY_HANDLE_SIZE 3
+#define RELAY_FRAME_SIZE \
+    (RELAY_HEADER_SIZE + RELAY_HANDLE_SIZE * CONFIG_INDICATOR_LED_SPLIT_RELAY_BATCH_MAX)
+
+// a write without a negotiated MTU carries 20 bytes
+BUILD_ASSERT(RELAY_FRAME_SIZE <= 20, "Relay frame does not fit the default ATT payload, "
+                                     "lower CONFIG_INDICATOR_LED_SPLIT_RELAY_BATCH_MAX");
+
+#define RELAY_SERVICE_UUID BT_UUID_128_ENCODE(0x5b1f0a30, 0x8c42, 0x4d6e, 0x9a1b, 0x3f6c2e7d8a10)
+#define RELAY_CHAR_UUID BT_UUID_128_ENCODE(0x5b1f0a31, 0x8c42, 0x4d6e, 0x9a1b, 0x3f6c2e7d8a10)
+
+int batt_led_relay_receive(const uint8_t *buf, size_t len) {
+    if (len < RELAY_HEADER_SIZE || len != RELAY_HEADER_SIZE + buf[0] * RELAY_HANDLE_SIZE) {
+        LOG_WRN("Dropping malformed relay frame of %zu bytes", len);
+        return -EINVAL;
+    }
+
+    uint32_t start = 0;
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_SYNC)
+    start = k_uptime_get_32() + sys_get_le16(&buf[1]);
+    if (start == 0) {
+        // zero means unsynchronized
+        start = 1;
+    }
+#endif
+
+    for (const uint8_t *handle = &buf[RELAY_HEADER_SIZE]; handle < &buf[len]; handle += RELAY_HANDLE_SIZE) {
+        const struct batt_led_source *src = batt_led_source_find(handle[0]);
+        uint8_t pattern = handle[1] & 0x0f;
+        if (src == NULL || pattern >= src->pattern_count) {
+            LOG_DBG("No pattern %d for relayed source %d", pattern, handle[0]);
+            continue;
+        }
+
+        struct blink_item blink = {
+            .pattern = &src->patterns[pattern],
+            .source = src->id,
+            .n_repeats = handle[2],
+            .priority = src->priority,
+            .flags = handle[1] >> 4,
+            .start = start,
+        };
+        // only the first indication is synchronized, the rest follow it in the queue
+        start = 0;
+        if (batt_led_enqueue(&blink) < 0) {
+            LOG_DBG("Blink queue full, dropping relayed indication for %s", src->name);
+        }
+    }
+    return 0;
+}
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_SYNC)
+uint16_t batt_led_relay_sync_delay_ms(uint32_t conn_interval_ms) {
+    // the write waits for the next connection event, on average half an interval away
+    uint32_t link_delay_ms = MIN(conn_interval_ms / 2, CONFIG_INDICATOR_LED_SPLIT_SYNC_LEAD_MS);
+    return CONFIG_INDICATOR_LED_SPLIT_SYNC_LEAD_MS - link_delay_ms;
+}
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL)
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_RELAY_LOOPBACK)
+
+// stand-in transport for testing without a second half: the central plays its own frames
+static void relay_send(uint8_t *frame, size_t len) {
+    batt_led_relay_receive(frame, len);
+}
+
+#else
+
+static struct bt_uuid_128 relay_char_uuid = BT_UUID_INIT_128(RELAY_CHAR_UUID);
+
+// value handle of the relay characteristic, per connection to a peripheral
+static uint16_t relay_handles[CONFIG_BT_MAX_CONN];
+
+static struct bt_gatt_discover_params relay_discover_params;
+static bool relay_discovering;
+
+static uint8_t relay_discover_cb(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                                 struct bt_gatt_discover_params *params) {
+    relay_discovering = false;
+    if (attr == NULL) {
+        LOG_DBG("Peripheral has no indicator relay characteristic");
+        return BT_GATT_ITER_STOP;
+    }
+
+    const struct bt_gatt_chrc *chrc = attr->user_data;
+    relay_handles[bt_conn_index(conn)] = chrc->value_handle;
+    LOG_DBG("Found indicator relay characteristic at handle %d", chrc->value_handle);
+    return BT_GATT_ITER_STOP;
+}
+
+static void relay_discover(struct bt_conn *conn) {
+    if (relay_discovering) {
+        return;
+    }
+
+    relay_discover_params = (struct bt_gatt_discover_params){
+        .uuid = &relay_char_uuid.uuid,
+        .func = relay_discover_cb,
+        .start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE,
+        .end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE,
+        .type = BT_GATT_DISCOVER_CHARACTERISTIC,
+    };
+    int err = bt_gatt_discover(conn, &relay_discover_params);
+    if (err < 0) {
+        LOG_DBG("Failed to start relay discovery (err %d)", err);
+        return;
+    }
+    relay_discovering = true;
+}
+
+static bool is_peripheral_conn(struct bt_conn *conn) {
+    struct bt_conn_info info;
+    return bt_conn_get_info(conn, &info) == 0 && info.role == BT_CONN_ROLE_CENTRAL;
+}
+
+static void relay_connected(struct bt_conn *conn, uint8_t err) {
+    if (err == 0 && is_peripheral_conn(conn)) {
+        relay_handles[bt_conn_index(conn)] = 0;
+        relay_discover(conn);
+    }
+}
+
+static void relay_disconnected(struct bt_conn *conn, uint8_t reason) {
+    relay_handles[bt_conn_index(conn)] = 0;
+}
+
+BT_CONN_CB_DEFINE(batt_led_relay_conn_callbacks) = {
+    .connected = relay_connected,
+    .disconnected = relay_disconnected,
+};
+
+struct relay_frame {
+    uint8_t *buf;
+    size_t len;
+};
+
+static void relay_send_conn(struct bt_conn *conn, void *data) {
+    const struct relay_frame *frame = data;
+    struct bt_conn_info info;
+
+    if (bt_conn_get_info(conn, &info) < 0 || info.role != BT_CONN_ROLE_CENTRAL) {
+        return;
+    }
+
+    uint16_t handle = relay_handles[bt_conn_index(conn)];
+    if (handle == 0) {
+        // frames are only worth anything right away, so this one is lost for this peripheral
+        relay_discover(conn);
+        return;
+    }
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_SYNC)
+    sys_put_le16(batt_led_relay_sync_delay_ms(BT_CONN_INTERVAL_TO_MS(info.le.interval)),
+                 &frame->buf[1]);
+#endif
+
+    int err = bt_gatt_write_without_response(conn, handle, frame->buf, frame->len, false);
+    if (err < 0) {
+        LOG_DBG("Failed to relay indications (err %d)", err);
+    }
+}
+
+static void relay_send(uint8_t *frame, size_t len) {
+    struct relay_frame data = {.buf = frame, .len = len};
+    bt_conn_foreach(BT_CONN_TYPE_LE, relay_send_conn, &data);
+}
+
+#endif // IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_RELAY_LOOPBACK)
+
+static struct k_spinlock relay_lock;
+// frame being batched, starting with its count byte
+static uint8_t relay_pending[RELAY_FRAME_SIZE];
+
+static void relay_flush_timer_expiry(struct batt_led_timer *timer) {
+    uint8_t frame[RELAY_FRAME_SIZE];
+    size_t len;
+
+    K_SPINLOCK(&relay_lock) {
+        len = RELAY_HEADER_SIZE + relay_pending[0] * RELAY_HANDLE_SIZE;
+        memcpy(frame, relay_pending, len);
+        relay_pending[0] = 0;
+    }
+
+    if (frame[0] == 0) {
+        return;
+    }
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_SYNC)
+    // play the same frame locally, the peripherals get their own delay from relay_send
+    sys_put_le16(CONFIG_INDICATOR_LED_SPLIT_SYNC_LEAD_MS, &frame[1]);
+    batt_led_relay_receive(frame, len);
+#endif
+
+    LOG_DBG("Relaying %d indications", frame[0]);
+    relay_send(frame, len);
+}
+
+static struct batt_led_timer relay_flush_timer =
+    BATT_LED_TIMER_INITIALIZER(relay_flush_timer_expiry);
+
+void batt_led_relay_push(const struct batt_led_source *src, const struct blink_item *blink) {
+    bool dropped = false;
+    bool full = false;
+
+    K_SPINLOCK(&relay_lock) {
+        uint8_t count = relay_pending[0];
+        if (count == CONFIG_INDICATOR_LED_SPLIT_RELAY_BATCH_MAX) {
+            dropped = true;
+        } else {
+            uint8_t *handle = &relay_pending[RELAY_HEADER_SIZE + count * RELAY_HANDLE_SIZE];
+            handle[0] = src->id;
+            handle[1] = (blink->pattern - src->patterns) | (blink->flags << 4);
+            handle[2] = blink->n_repeats;
+            relay_pending[0] = ++count;
+            full = count == CONFIG_INDICATOR_LED_SPLIT_RELAY_BATCH_MAX;
+        }
+    }
+
+    if (dropped) {
+        LOG_DBG("Relay batch full, dropping indication for %s", src->name);
+        return;
+    }
+    if (full) {
+        batt_led_timer_start(&relay_flush_timer, k_uptime_get());
+    } else if (!batt_led_timer_is_pending(&relay_flush_timer)) {
+        // a flush already pending keeps its deadline, batching this handle with it
+        batt_led_timer_start_in(&relay_flush_timer, CONFIG_INDICATOR_LED_SPLIT_RELAY_BATCH_MS);
+    }
+}
+
+#elif !IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_RELAY_LOOPBACK)
+
+static ssize_t relay_write_cb(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                              const void *buf, uint16_t len, uint16_t offset, uint8_t flags) {
+    if (offset != 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+    }
+    if (batt_led_relay_receive(buf, len) < 0) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+    return len;
+}
+
+BT_GATT_SERVICE_DEFINE(batt_led_relay_svc,
+                       BT_GATT_PRIMARY_SERVICE(BT_UUID_DECLARE_128(RELAY_SERVICE_UUID)),
+                       BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(RELAY_CHAR_UUID),
+                                              BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+                                              BT_GATT_PERM_WRITE_ENCRYPT, NULL, relay_write_cb,
+                                              NULL));
+
+#endif // IS_ENABLED(CONFIG_ZMK_SPLIT_ROLE_CENTRAL)
@@ -0,0 +1,77 @@
+/*
+ * Last shown state of the boot indication sources, kept across warm resets in RAM that the
+ * startup code does not clear. On boot, the sources start from the keys they had shown before
+ * the reset, so their dedup drops indications of states that did not change.
+ *
+ * A magic number and a CRC tell a copy written before the reset apart from whatever a power
+ * cycle left in RAM; an invalid copy is reset and everything is shown as after a cold boot.
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/sys/crc.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// changes with the layout below, so that a copy from another firmware version is not taken over
+#define RETAINED_MAGIC 0x424c4401
+
+// only built-in sources retain their state, so their ids fit below ZMK_INDICATOR_LED_SOURCE_USER
+struct retained_state {
+    uint32_t magic;
+    // ids of the sources with a valid key
+    uint32_t valid;
+    uint32_t keys[ZMK_INDICATOR_LED_SOURCE_USER];
+    uint32_t crc;
+};
+
+static __noinit struct retained_state retained;
+
+static struct k_spinlock retained_lock;
+static bool restored;
+static bool changed;
+
+static uint32_t retained_crc(void) {
+    return crc32_ieee((const uint8_t *)&retained, offsetof(struct retained_state, crc));
+}
+
+void batt_led_retained_restore(void) {
+    K_SPINLOCK(&retained_lock) {
+        if (retained.magic != RETAINED_MAGIC || retained.crc != retained_crc()) {
+            LOG_DBG("No retained indicator state, showing all boot indications");
+            memset(&retained, 0, sizeof(retained));
+            retained.magic = RETAINED_MAGIC;
+            retained.crc = retained_crc();
+            K_SPINLOCK_BREAK;
+        }
+
+        STRUCT_SECTION_FOREACH(batt_led_source, src) {
+            if ((src->flags & BATT_LED_SOURCE_RETAIN) && (retained.valid & BIT(src->id))) {
+                src->state->last_key = retained.keys[src->id];
+                src->state->has_key = true;
+            }
+        }
+        restored = true;
+    }
+}
+
+void batt_led_retained_save(uint8_t id, uint32_t key) {
+    __ASSERT(id < ZMK_INDICATOR_LED_SOURCE_USER, "Only built-in sources can retain their state");
+
+    K_SPINLOCK(&retained_lock) {
+        retained.keys[id] = key;
+        retained.valid |= BIT(id);
+        retained.crc = retained_crc();
+        changed = true;
+    }
+}
+
+bool batt_led_retained_unchanged(void) {
+    return restored && !changed;
+}
@@ -0,0 +1,224 @@
+/*
+ * "indicator" shell commands, for looking into the indicator's state on a running keyboard and
+ * trying out patterns without rebuilding the firmware.
+ */
+
+#include <stdlib.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+#include "batt_leds.h"
+
+// longest pattern that can be typed in for the play command
+#define SHELL_PATTERN_MAX_STEPS 16
+
+static const char *source_name(uint8_t id) {
+    const struct batt_led_source *src = batt_led_source_find(id);
+    if (src != NULL) {
+        return src->name;
+    }
+    return id == BATT_LED_SOURCE_ID_SHELL ? "shell" : "user";
+}
+
+static void print_item(const struct shell *sh, const struct blink_item *blink) {
+    shell_fprintf(sh, SHELL_NORMAL, "%-16s %2u  x%-3u prio %u  steps", source_name(blink->source),
+                  blink->source, blink->n_repeats, blink->priority);
+    const struct zmk_indicator_led_pattern *pattern = blink->pattern;
+    switch (pattern->generator) {
+    case ZMK_INDICATOR_LED_GEN_BREATHE:
+        shell_fprintf(sh, SHELL_NORMAL, " breathe %u ms in %zu\n", pattern->period_ms,
+                      pattern->sequence_len);
+        return;
+    case ZMK_INDICATOR_LED_GEN_CHIRP:
+        shell_fprintf(sh, SHELL_NORMAL, " chirp %u-%u ms in %zu\n", pattern->period_ms,
+                      pattern->end_period_ms, pattern->sequence_len);
+        return;
+    }
+    for (size_t i = 0; i < pattern->sequence_len; i++) {
+        shell_fprintf(sh, SHELL_NORMAL, "%c%u", i == 0 ? ' ' : ',', pattern->sequence[i]);
+    }
+    shell_fprintf(sh, SHELL_NORMAL, "\n");
+}
+
+static int cmd_list(const struct shell *sh, size_t argc, char **argv) {
+    struct batt_led_player_status status;
+    uint32_t start_ms = 0;
+
+    if (batt_led_player_status(&status)) {
+        start_ms = status.remaining_ms;
+    }
+
+    struct blink_item blink;
+    uint32_t n_queued = 0;
+    for (uint32_t i = 0; batt_led_queue_peek_at(i, &blink) == 0; i++) {
+        // ignores backlog compression, which only makes things faster
+        start_ms += batt_led_cfg.interval_ms + BLINK_PREROLL_MS;
+        uint32_t duration_ms = blink_item_duration_ms(&blink);
+        shell_fprintf(sh, SHELL_NORMAL, "%u: starts in ~%u ms, lasts %u ms: ", i, start_ms,
+                      duration_ms);
+        print_item(sh, &blink);
+        start_ms += duration_ms;
+        n_queued++;
+    }
+    shell_print(sh, "%u of %u queued", n_queued, BATT_LED_QUEUE_DEPTH);
+    return 0;
+}
+
+static int cmd_current(const struct shell *sh, size_t argc, char **argv) {
+    struct batt_led_player_status status;
+
+    if (!batt_led_player_status(&status)) {
+        shell_print(sh, "Idle");
+        return 0;
+    }
+
+    print_item(sh, &status.blink);
+    shell_print(sh, "At repeat %u step %u, %u ms left", status.repeat, status.step,
+                status.remaining_ms);
+    return 0;
+}
+
+static int cmd_flush(const struct shell *sh, size_t argc, char **argv) {
+    for (uint8_t id = 0; id < ZMK_INDICATOR_LED_SOURCE_ID_MAX; id++) {
+        zmk_indicator_led_cancel(id);
+    }
+    return 0;
+}
+
+static int cmd_cancel(const struct shell *sh, size_t argc, char **argv) {
+    char *end;
+    unsigned long id = strtoul(argv[1], &end, 0);
+
+    // checked before narrowing to a source id, 256 would otherwise cancel source 0
+    if (end == argv[1] || *end != '\0' || id >= ZMK_INDICATOR_LED_SOURCE_ID_MAX) {
+        shell_error(sh, "Invalid source id %s", argv[1]);
+        return -EINVAL;
+    }
+    return zmk_indicator_led_cancel(id);
+}
+
+static int cmd_play(const struct shell *sh, size_t argc, char **argv) {
+    // two buffers, so that the one being overwritten was cancelled a command ago
+    static uint16_t steps[2][SHELL_PATTERN_MAX_STEPS];
+    static struct zmk_indicator_led_pattern patterns[2];
+    static uint8_t next;
+
+    unsigned long repeats = 1;
+    if (argc > 2) {
+        char *end;
+        repeats = strtoul(argv[2], &end, 0);
+        if (*end != '\0' || repeats == 0 || repeats > UINT8_MAX) {
+            shell_error(sh, "Invalid repeat count %s", argv[2]);
+            return -EINVAL;
+        }
+    }
+
+    zmk_indicator_led_cancel(BATT_LED_SOURCE_ID_SHELL);
+
+    size_t n_steps = 0;
+    for (char *pos = argv[1]; *pos != '\0'; n_steps++) {
+        char *end;
+        unsigned long duration_ms = strtoul(pos, &end, 10);
+        if (end == pos || (*end != ',' && *end != '\0') || duration_ms == 0 ||
+            duration_ms > UINT16_MAX || n_steps == SHELL_PATTERN_MAX_STEPS) {
+            shell_error(sh, "Expected up to %d comma separated durations in ms",
+                        SHELL_PATTERN_MAX_STEPS);
+            return -EINVAL;
+        }
+        steps[next][n_steps] = duration_ms;
+        pos = *end == ',' ? end + 1 : end;
+    }
+
+    patterns[next] = (struct zmk_indicator_led_pattern){
+        .sequence = steps[next],
+        .sequence_len = n_steps,
+    };
+    int err = zmk_indicator_led_enqueue(BATT_LED_SOURCE_ID_SHELL, &patterns[next], repeats,
+                                        ZMK_INDICATOR_LED_PRIO_NORMAL, 0);
+    if (err < 0) {
+        shell_error(sh, "Failed to queue pattern (err %d)", err);
+        return err;
+    }
+    next = !next;
+    return 0;
+}
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_RUNTIME_CONFIG)
+static int cmd_config(const struct shell *sh, size_t argc, char **argv) {
+    if (argc == 1) {
+        const char *name;
+        uint32_t value;
+        for (size_t i = 0; batt_led_config_get(i, &name, &value) == 0; i++) {
+            shell_print(sh, "%-30s %u", name, value);
+        }
+        return 0;
+    }
+
+    if (argc != 3) {
+        shell_error(sh, "Expected a name and a value");
+        return -EINVAL;
+    }
+
+    char *end;
+    unsigned long value = strtoul(argv[2], &end, 0);
+    int err = -EINVAL;
+    if (end != argv[2] && *end == '\0' && value == (uint32_t)value) {
+        err = batt_led_config_set(argv[1], value);
+    }
+    if (err == -ENOENT) {
+        shell_error(sh, "Unknown setting %s", argv[1]);
+    } else if (err < 0) {
+        shell_error(sh, "Invalid value %s for %s", argv[2], argv[1]);
+    }
+    return err;
+}
+#endif
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BATTERY_HISTORY)
+static int cmd_history(const struct shell *sh, size_t argc, char **argv) {
+    struct batt_led_history_sample sample;
+
+    shell_print(sh, "%zu battery samples, newest first:", batt_led_history_count());
+    for (size_t i = 0; batt_led_history_get(i, &sample) == 0; i++) {
+        shell_print(sh, "  %3u%%  %6us ago", sample.level, sample.age_s);
+    }
+
+    uint32_t minutes;
+    if (batt_led_history_time_to_empty(&minutes) < 0) {
+        shell_print(sh, "Time to empty: not enough discharge history");
+    } else {
+        shell_print(sh, "Time to empty: %uh %02um", minutes / 60, minutes % 60);
+    }
+    return 0;
+}
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_indicator,
+                               SHELL_CMD(list, NULL, "List queued sequences", cmd_list),
+                               SHELL_CMD(current, NULL, "Show the sequence being played",
+                                         cmd_current),
+                               SHELL_CMD(flush, NULL, "Drop all queued and playing sequences",
+                                         cmd_flush),
+                               SHELL_CMD_ARG(cancel, NULL,
+                                             "Drop the sequences of a source\n"
+                                             "usage: cancel <source id>",
+                                             cmd_cancel, 2, 0),
+                               SHELL_CMD_ARG(play, NULL,
+                                             "Play a pattern, replacing one played before\n"
+                                             "usage: play <on ms>,<off ms>[,...] [repeats]",
+                                             cmd_play, 2, 1),
+#if IS_ENABLED(CONFIG_INDICATOR_LED_RUNTIME_CONFIG)
+                               SHELL_CMD_ARG(config, NULL,
+                                             "Show the runtime settings, or change one; changes "
+                                             "are saved\n"
+                                             "usage: config [<name> <value>]",
+                                             cmd_config, 1, 2),
+#endif
+#if IS_ENABLED(CONFIG_INDICATOR_LED_BATTERY_HISTORY)
+                               SHELL_CMD(history, NULL, "Show battery samples and time to empty",
+                                         cmd_history),
+#endif
+                               SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(indicator, &sub_indicator, "Indicator LED commands", NULL);
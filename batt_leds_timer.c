@@ -0,0 +1,253 @@
+/*
+ * Hierarchical timer wheel shared by everything time-based in the module: LED edges, boot
+ * indications, relay batching and settings debounce.
+ *
+ * Timers live in WHEEL_LEVELS levels of WHEEL_SLOTS slots. A timer goes in the lowest level
+ * whose window still contains its expiry, and moves down a level when the wheel reaches the
+ * start of its slot, so insert and cancel are O(1). Timers beyond the top level wait in a far
+ * list that is revisited when the top level wraps. A single thread sleeps until the earliest
+ * slot that needs attention, which the per-level occupancy bitmaps give without scanning.
+ *
+ * The wheel ticks every 2 * CONFIG_INDICATOR_LED_TIMER_SLACK_MS (or every ms without slack), and
+ * deadlines round to the nearest tick, so timers that are close together expire on one wakeup.
+ */
+
+#include <zephyr/kernel.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define WHEEL_TICK_MS MAX(2 * CONFIG_INDICATOR_LED_TIMER_SLACK_MS, 1)
+#define WHEEL_BITS 4
+#define WHEEL_SLOTS BIT(WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_FAR_LEVEL WHEEL_LEVELS
+#define WHEEL_NEVER UINT64_MAX
+
+static struct {
+    struct batt_led_timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint16_t occupied[WHEEL_LEVELS];
+    struct batt_led_timer *far;
+    // last tick the wheel has processed
+    uint64_t now;
+    // tick the wheel thread is sleeping until
+    uint64_t wake_at;
+    uint32_t wakeups;
+} wheel = {.wake_at = WHEEL_NEVER};
+
+static struct k_spinlock wheel_lock;
+static K_SEM_DEFINE(wheel_sem, 0, 1);
+
+static inline uint64_t level_shift(uint8_t level) {
+    return WHEEL_BITS * level;
+}
+
+static inline uint8_t level_index(uint64_t tick, uint8_t level) {
+    return (tick >> level_shift(level)) & (WHEEL_SLOTS - 1);
+}
+
+static void wheel_link(struct batt_led_timer **head, struct batt_led_timer *timer) {
+    timer->next = *head;
+    if (timer->next != NULL) {
+        timer->next->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+}
+
+static void wheel_unlink(struct batt_led_timer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    if (timer->level < WHEEL_LEVELS && wheel.slots[timer->level][timer->slot] == NULL) {
+        wheel.occupied[timer->level] &= ~BIT(timer->slot);
+    }
+    timer->pprev = NULL;
+}
+
+static void wheel_insert(struct batt_led_timer *timer) {
+    uint8_t level = 0;
+
+    // the lowest level whose current window, shared with the wheel's position, holds the expiry
+    while (level < WHEEL_LEVELS &&
+           (timer->expires >> level_shift(level + 1)) != (wheel.now >> level_shift(level + 1))) {
+        level++;
+    }
+
+    timer->level = level;
+    if (level == WHEEL_FAR_LEVEL) {
+        wheel_link(&wheel.far, timer);
+        return;
+    }
+
+    timer->slot = level_index(timer->expires, level);
+    wheel_link(&wheel.slots[level][timer->slot], timer);
+    wheel.occupied[level] |= BIT(timer->slot);
+}
+
+// next tick at which a timer expires or has to move down a level
+static uint64_t wheel_next_tick(void) {
+    uint64_t next = WHEEL_NEVER;
+
+    for (uint8_t level = 0; level < WHEEL_LEVELS; level++) {
+        // timers only ever sit in slots after the wheel's current one
+        uint16_t ahead = wheel.occupied[level] & ~(BIT(level_index(wheel.now, level) + 1) - 1);
+        if (ahead != 0) {
+            uint64_t window = wheel.now & ~(BIT64(level_shift(level + 1)) - 1);
+            next = MIN(next, window + ((uint64_t)__builtin_ctz(ahead) << level_shift(level)));
+        }
+    }
+
+    if (wheel.far != NULL) {
+        uint64_t top = BIT64(level_shift(WHEEL_LEVELS));
+        next = MIN(next, (wheel.now & ~(top - 1)) + top);
+    }
+    return next;
+}
+
+// reinsert a list of timers relative to the wheel's new position
+static void wheel_cascade(struct batt_led_timer **head) {
+    struct batt_led_timer *timer = *head;
+    *head = NULL;
+
+    while (timer != NULL) {
+        struct batt_led_timer *next = timer->next;
+        timer->pprev = NULL;
+        wheel_insert(timer);
+        timer = next;
+    }
+}
+
+static void wheel_advance(uint64_t tick) {
+    wheel.now = tick;
+
+    if ((tick & (BIT64(level_shift(WHEEL_LEVELS)) - 1)) == 0) {
+        wheel_cascade(&wheel.far);
+    }
+    for (uint8_t level = WHEEL_LEVELS - 1; level > 0; level--) {
+        if ((tick & (BIT64(level_shift(level)) - 1)) == 0) {
+            uint8_t slot = level_index(tick, level);
+            wheel.occupied[level] &= ~BIT(slot);
+            wheel_cascade(&wheel.slots[level][slot]);
+        }
+    }
+}
+
+static void wheel_run(uint64_t target) {
+    k_spinlock_key_t key = k_spin_lock(&wheel_lock);
+    uint64_t next;
+
+    while ((next = wheel_next_tick()) <= target) {
+        wheel_advance(next);
+
+        uint8_t slot = level_index(next, 0);
+        struct batt_led_timer *timer;
+        while ((timer = wheel.slots[0][slot]) != NULL) {
+            wheel_unlink(timer);
+            k_spin_unlock(&wheel_lock, key);
+            // callbacks may restart their own or other timers
+            timer->expiry(timer);
+            key = k_spin_lock(&wheel_lock);
+        }
+    }
+    wheel.now = MAX(wheel.now, target);
+
+    k_spin_unlock(&wheel_lock, key);
+}
+
+void batt_led_timer_start(struct batt_led_timer *timer, int64_t deadline_ms) {
+    // round to the nearest tick, moving the deadline by at most the slack
+    uint64_t expires = (MAX(deadline_ms, 0) + WHEEL_TICK_MS / 2) / WHEEL_TICK_MS;
+    bool wake = false;
+
+    K_SPINLOCK(&wheel_lock) {
+        if (timer->pprev != NULL) {
+            wheel_unlink(timer);
+        }
+        // ticks up to now have been processed already
+        timer->expires = MAX(expires, wheel.now + 1);
+        wheel_insert(timer);
+        wake = timer->expires < wheel.wake_at;
+    }
+
+    if (wake) {
+        k_sem_give(&wheel_sem);
+    }
+}
+
+void batt_led_timer_start_in(struct batt_led_timer *timer, uint32_t delay_ms) {
+    batt_led_timer_start(timer, k_uptime_get() + delay_ms);
+}
+
+void batt_led_timer_cancel(struct batt_led_timer *timer) {
+    K_SPINLOCK(&wheel_lock) {
+        if (timer->pprev != NULL) {
+            wheel_unlink(timer);
+        }
+    }
+}
+
+bool batt_led_timer_is_pending(const struct batt_led_timer *timer) {
+    return timer->pprev != NULL;
+}
+
+uint32_t batt_led_timer_wakeups(void) {
+    return wheel.wakeups;
+}
+
+#if IS_ENABLED(CONFIG_INDICATOR_LED_STACK_ANALYSIS)
+// highest stack usage of the thread seen so far, in bytes
+static size_t stack_peak;
+
+// log each new peak of the thread's stack usage; scans the whole unused part of the stack
+static void stack_usage_check(void) {
+    const struct k_thread *thread = k_current_get();
+    size_t unused;
+
+    if (k_thread_stack_space_get(thread, &unused) == 0 &&
+        thread->stack_info.size - unused > stack_peak) {
+        stack_peak = thread->stack_info.size - unused;
+        LOG_INF("Indicator timer thread peak stack usage %zu of %zu bytes", stack_peak,
+                thread->stack_info.size);
+    }
+}
+
+size_t batt_led_timer_stack_peak(void) {
+    return stack_peak;
+}
+#endif
+
+extern void batt_led_timer_thread(void *d0, void *d1, void *d2) {
+    ARG_UNUSED(d0);
+    ARG_UNUSED(d1);
+    ARG_UNUSED(d2);
+
+    while (true) {
+        uint64_t next;
+        K_SPINLOCK(&wheel_lock) {
+            next = wheel_next_tick();
+            wheel.wake_at = next;
+        }
+
+        // the single kernel timeout used by the module, programmed for the earliest timer
+        k_timeout_t timeout = K_FOREVER;
+        if (next != WHEEL_NEVER) {
+            timeout = K_MSEC(MAX((int64_t)(next * WHEEL_TICK_MS) - k_uptime_get(), 0));
+        }
+        k_sem_take(&wheel_sem, timeout);
+
+        wheel.wakeups++;
+        wheel_run(k_uptime_get() / WHEEL_TICK_MS);
+#if IS_ENABLED(CONFIG_INDICATOR_LED_STACK_ANALYSIS)
+        stack_usage_check();
+#endif
+    }
+}
+
+// define batt_led_timer_thread, it runs all blink sequences and timers
+K_THREAD_DEFINE(batt_led_timer_tid, CONFIG_INDICATOR_LED_THREAD_STACK_SIZE, batt_led_timer_thread,
+                NULL, NULL, NULL, K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
@@ -0,0 +1,113 @@
+/*
+ * Indicator LED interface for other modules in the same firmware, e.g. behaviors or sensor
+ * drivers that want to blink the indicator LED.
+ *
+ * Every function may be called from any thread or ISR and never blocks. Each one only takes a
+ * fixed number of spinlock sections of constant length (queue, timer, LED state), so its
+ * worst-case execution time does not depend on what is queued or playing. The LED state section
+ * may switch the LED, which is why the indicator-led alias is limited to gpio-leds and pwm-leds:
+ * both set a GPIO or PWM channel directly, without sleeping, and the build fails for any other
+ * LED driver.
+ *
+ * Patterns are referenced, not copied: they must stay valid until played, which const arrays in
+ * flash always do.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zephyr/sys/util.h>
+
+// how the steps of a pattern are produced
+enum zmk_indicator_led_generator {
+    // from the sequence array
+    ZMK_INDICATOR_LED_GEN_SEQUENCE,
+    // brightness fading up and down like a sine, over period_ms in sequence_len steps
+    ZMK_INDICATOR_LED_GEN_BREATHE,
+    // on/off pulses whose period sweeps linearly from period_ms to end_period_ms
+    ZMK_INDICATOR_LED_GEN_CHIRP,
+};
+
+/*
+ * A blink sequence in ms: LED on for evens (0 == start), off for odds. Generator patterns have
+ * no array, their steps are computed while playing from the period fields.
+ */
+struct zmk_indicator_led_pattern {
+    const uint16_t *sequence;
+    // number of steps, also for generators
+    size_t sequence_len;
+    uint8_t generator;
+    uint16_t period_ms;
+    uint16_t end_period_ms;
+};
+
+#define ZMK_INDICATOR_LED_PATTERN(seq) \
+    { \
+        .sequence = seq, \
+        .sequence_len = ARRAY_SIZE(seq) \
+    }
+
+// one breath of the given period, in n_steps brightness steps; needs a pwm-leds LED to fade
+#define ZMK_INDICATOR_LED_BREATHE(_period_ms, _n_steps) \
+    { \
+        .sequence_len = _n_steps, \
+        .generator = ZMK_INDICATOR_LED_GEN_BREATHE, \
+        .period_ms = _period_ms \
+    }
+
+// n_pulses blinks, speeding up (or slowing down) from one period to the other
+#define ZMK_INDICATOR_LED_CHIRP(_from_period_ms, _to_period_ms, _n_pulses) \
+    { \
+        .sequence_len = 2 * (_n_pulses), \
+        .generator = ZMK_INDICATOR_LED_GEN_CHIRP, \
+        .period_ms = _from_period_ms, \
+        .end_period_ms = _to_period_ms \
+    }
+
+// source ids below this one are used by the built-in indications
+#define ZMK_INDICATOR_LED_SOURCE_USER 8
+#define ZMK_INDICATOR_LED_SOURCE_ID_MAX 16
+
+// keep the LED lit after the sequence, until the same source plays again
+#define ZMK_INDICATOR_LED_FLAG_HOLD BIT(0)
+// n_repeats is a number, blinked as configured by INDICATOR_LED_INDEX_ENCODING
+#define ZMK_INDICATOR_LED_FLAG_INDEX BIT(1)
+
+enum zmk_indicator_led_priority {
+    ZMK_INDICATOR_LED_PRIO_LOW,
+    ZMK_INDICATOR_LED_PRIO_NORMAL,
+    ZMK_INDICATOR_LED_PRIO_HIGH,
+    ZMK_INDICATOR_LED_PRIO_CRITICAL,
+};
+
+/*
+ * Queue a pattern to be played n_repeats times. Returns -EINVAL for an invalid source id or
+ * pattern, or -ENOMSG if the queue is full.
+ */
+int zmk_indicator_led_enqueue(uint8_t source_id, const struct zmk_indicator_led_pattern *pattern,
+                              uint8_t n_repeats, uint8_t priority, uint8_t flags);
+
+/*
+ * Drop everything a source has queued, and stop its sequence if it is playing; the LED follows
+ * within one pattern step. Also clears the source's held state. Returns -EINVAL for an invalid
+ * source id.
+ */
+int zmk_indicator_led_cancel(uint8_t source_id);
+
+struct zmk_indicator_led_state {
+    // the LED is lit right now
+    bool on;
+    // its brightness in percent
+    uint8_t brightness;
+    // a held source or host indicator lights the background
+    bool background;
+    // source of the sequence being played, or -1 if none is
+    int8_t playing_source;
+    // number of sequences waiting to be played
+    uint8_t queued;
+};
+
+void zmk_indicator_led_get_state(struct zmk_indicator_led_state *state);
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""
+ROM and RAM taken by each feature of the indicator LED module, from a Zephyr linker map.
+
+Most optional features live in their own batt_leds_*.c file and are reported by file. The
+indications in batt_leds.c share a file, so its input sections are attributed by the symbol in
+their name, which Zephyr's -ffunction-sections and -fdata-sections builds give every function and
+variable. Sections without a symbol count towards the file's shared part. Initialized data counts
+towards both ROM and RAM.
+
+usage: footprint.py <zephyr.map> [<zephyr.map> ...]
+"""
+
+import re
+import sys
+
+MODULE_OBJ = re.compile(r"\b(batt_leds\w*)\.c\.obj\b")
+REGION = re.compile(r"^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(\s+\S+)?\s*$")
+OUTPUT_SECTION = re.compile(r"^(\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(\s+load address 0x([0-9a-fA-F]+))?\s*$")
+ZERO_INIT = (".bss", ".noinit", "COMMON")
+INPUT_SECTION = re.compile(r"^ (\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+# suffixes GCC gives clones and local statics, e.g. .text.classify_ble.constprop.0
+SYMBOL_SUFFIX = re.compile(r"^(\d+|constprop|isra|part|cold|lto_priv)$")
+
+# features sharing a file, by symbol; the first match wins, unmatched symbols are the file's shared
+# part. Keep in step with the #if blocks of batt_leds.c.
+FEATURES = {
+    "batt_leds.c": [
+        ("compositor", r"^(led_|batt_led_(background|foreground)_update$|batt_led_compositor_state$)"),
+        ("hid_indicators", r"hid_indicators"),
+        ("ble", r"(^|_)(ble|profile)(_|$)"),
+        ("layer", r"layer"),
+        ("retained", r"^boot_unchanged"),
+        ("battery_runtime", r"runtime"),
+        ("battery_shared", r"^(battery_patterns|CONFIG_INDICATOR_LED_BATTERY_\w+_PATTERN|battery_level_min)$"),
+        ("battery_critical", r"critical|battery_filtered"),
+        ("battery_boot", r"battery_boot|boot_battery|startup_battery|battery_sensor|battery_half"),
+        ("peripheral_battery", r"peripheral_battery"),
+    ],
+}
+
+
+def ram_regions(lines):
+    """Address ranges of the writable memory regions in the map's memory configuration."""
+    regions = []
+    in_config = False
+    for line in lines:
+        if line.startswith("Memory Configuration"):
+            in_config = True
+        elif line.startswith("Linker script and memory map"):
+            break
+        elif in_config:
+            m = REGION.match(line)
+            if m and m.group(4) and "w" in m.group(4) and m.group(1) != "*default*":
+                origin = int(m.group(2), 16)
+                regions.append((origin, origin + int(m.group(3), 16)))
+    return regions
+
+
+def section_symbol(name):
+    """Function or variable an input section holds, e.g. classify_ble for .text.classify_ble."""
+    parts = name.split(".")
+    while len(parts) > 1 and SYMBOL_SUFFIX.match(parts[-1]):
+        parts.pop()
+    # a bare .text or .bss holds several symbols
+    return parts[-1] if len(parts) > 2 else None
+
+
+def feature(file, name):
+    """Feature an input section of a module file counts towards."""
+    features = FEATURES.get(file)
+    if features is None:
+        return file
+    symbol = section_symbol(name)
+    for label, pattern in features:
+        if symbol is not None and re.search(pattern, symbol, re.IGNORECASE):
+            return f"{file}:{label}"
+    return f"{file}:shared"
+
+
+def footprint(path):
+    """{feature: [rom, ram]} for the module's object files in a linker map."""
+    with open(path, encoding="utf-8", errors="replace") as f:
+        lines = f.read().splitlines()
+
+    ram = ram_regions(lines)
+    in_ram = lambda addr: any(lo <= addr < hi for lo, hi in ram)
+    sizes = {}
+    loaded = False
+    pending_name = None
+
+    start = next((i for i, l in enumerate(lines) if l.startswith("Linker script and memory map")), 0)
+    for line in lines[start:]:
+        if not line.startswith(" "):
+            # output section header, possibly with its addresses on the next line
+            m = OUTPUT_SECTION.match(line)
+            if m:
+                loaded = m.group(5) is not None and int(m.group(5), 16) != int(m.group(2), 16)
+            pending_name = None
+            continue
+
+        m = INPUT_SECTION.match(line)
+        if m is None:
+            # a long input section name, with its addresses on the next line
+            if re.match(r"^ \S+$", line):
+                pending_name = line.strip()
+            elif OUTPUT_SECTION.match(line) and pending_name is None:
+                m = OUTPUT_SECTION.match(line)
+                loaded = m.group(5) is not None and int(m.group(5), 16) != int(m.group(2), 16)
+            continue
+
+        obj = MODULE_OBJ.search(m.group(4))
+        name = m.group(1) or pending_name
+        pending_name = None
+        size = int(m.group(3), 16)
+        if obj is None or name is None or size == 0:
+            continue
+
+        entry = sizes.setdefault(feature(obj.group(1) + ".c", name), [0, 0])
+        if in_ram(int(m.group(2), 16)):
+            entry[1] += size
+            # zero-initialized sections only take RAM, even where the map gives a load address
+            if loaded and not name.startswith(ZERO_INIT):
+                entry[0] += size
+        else:
+            entry[0] += size
+    return sizes
+
+
+def main(paths):
+    if not paths:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+
+    for path in paths:
+        sizes = footprint(path)
+        print(path)
+        print(f"  {'feature':<32} {'ROM':>8} {'RAM':>8}")
+        for name, (rom, ram) in sorted(sizes.items()):
+            print(f"  {name:<32} {rom:>8} {ram:>8}")
+        total_rom = sum(rom for rom, _ in sizes.values())
+        total_ram = sum(ram for _, ram in sizes.values())
+        print(f"  {'total':<32} {total_rom:>8} {total_ram:>8}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
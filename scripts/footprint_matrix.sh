@@ -0,0 +1,47 @@
+#!/bin/sh
+# Build the module with a matrix of feature combinations and print its footprint for each.
+#
+# usage: scripts/footprint_matrix.sh <board> [cmake args...]
+#   e.g. scripts/footprint_matrix.sh nice_nano_v2 -DSHIELD=corne_left -DZMK_EXTRA_MODULES=$PWD
+#
+# Runs from a west workspace with ZMK; ZMK_APP points at its app directory (default zmk/app).
+# Builds go to build/footprint/<combination>.
+
+set -e
+
+if [ $# -lt 1 ]; then
+    sed -n '2,8p' "$0"
+    exit 2
+fi
+
+board=$1
+shift
+app=${ZMK_APP:-zmk/app}
+report=$(dirname "$0")/footprint.py
+
+none="-DCONFIG_INDICATOR_LED_SHOW_LAYER_CHANGE=n -DCONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT=n \
+-DCONFIG_INDICATOR_LED_SHOW_CRITICAL_BATTERY_CHANGES=n -DCONFIG_INDICATOR_LED_SHOW_BLE=n"
+
+build() {
+    name=$1
+    shift
+    dir=build/footprint/$name
+    west build -p -s "$app" -b "$board" -d "$dir" -- "$@" >"$dir.log" 2>&1 ||
+        { echo "$name: build failed, see $dir.log"; return 0; }
+    echo "== $name"
+    python3 "$report" "$dir/zephyr/zephyr.map"
+}
+
+mkdir -p build/footprint
+
+# shellcheck disable=SC2086 # the combinations are lists of arguments
+build defaults "$@"
+build nothing "$@" $none
+build hid_only "$@" $none -DCONFIG_ZMK_HID_INDICATORS=y \
+    -DCONFIG_INDICATOR_LED_SHOW_HID_INDICATORS=y
+build layer_only "$@" $none -DCONFIG_INDICATOR_LED_SHOW_LAYER_CHANGE=y
+build battery_only "$@" $none -DCONFIG_INDICATOR_LED_SHOW_BATTERY_ON_BOOT=y
+build ble_only "$@" $none -DCONFIG_INDICATOR_LED_SHOW_BLE=y
+build everything "$@" -DCONFIG_INDICATOR_LED_BATTERY_HISTORY=y \
+    -DCONFIG_INDICATOR_LED_RETAINED_STATE=y -DCONFIG_INDICATOR_LED_API=y \
+    -DCONFIG_INDICATOR_LED_SHELL=y -DCONFIG_SHELL=y
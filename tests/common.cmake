@@ -0,0 +1,11 @@
+# Builds module sources straight into a test, without the rest of ZMK. Only ZMK's headers are
+# used, from ZMK_APP_DIR, which defaults to zmk/app next to zephyr in a west workspace.
+
+set(INDICATOR_LED_DIR ${CMAKE_CURRENT_LIST_DIR}/..)
+set(ZMK_APP_DIR ${ZEPHYR_BASE}/../zmk/app CACHE PATH "ZMK application directory, for its headers")
+
+target_include_directories(app PRIVATE
+  ${INDICATOR_LED_DIR}
+  ${INDICATOR_LED_DIR}/include
+  ${ZMK_APP_DIR}/include
+)
@@ -0,0 +1,113 @@
+/*
+ * Changing the runtime configuration by name, as the "indicator config" shell command does, and
+ * its persistence through the settings subsystem.
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/ztest.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+static const struct batt_led_config config_defaults = BATT_LED_CONFIG_DEFAULTS;
+
+// margin for the save to go through after the debounce
+#define SAVE_WAIT K_MSEC(CONFIG_ZMK_SETTINGS_SAVE_DEBOUNCE + 50)
+
+static int stored_config_cb(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg,
+                            void *param) {
+    const char *next;
+    if (!settings_name_steq(key, "config", &next) || next != NULL ||
+        len != sizeof(struct batt_led_config)) {
+        return 0;
+    }
+    return read_cb(cb_arg, param, len) < 0 ? -EIO : 0;
+}
+
+// the configuration as stored in flash, all zeroes if there is none
+static struct batt_led_config stored_config(void) {
+    struct batt_led_config cfg = {};
+
+    zassert_ok(settings_load_subtree_direct("indicator_led", stored_config_cb, &cfg));
+    return cfg;
+}
+
+static void *config_setup(void) {
+    zassert_ok(settings_subsys_init());
+    return NULL;
+}
+
+static void config_before(void *fixture) {
+    zassert_ok(batt_led_config_update(&config_defaults));
+}
+
+ZTEST(indicator_led_config, test_set_applies_right_away) {
+    zassert_ok(batt_led_config_set("battery_level_low", 30));
+    zassert_equal(batt_led_cfg.battery_level_low, 30);
+
+    zassert_ok(batt_led_config_set("interval_ms", 1200));
+    zassert_equal(batt_led_cfg.interval_ms, 1200);
+}
+
+ZTEST(indicator_led_config, test_get_lists_every_value) {
+    const char *name;
+    uint32_t value;
+    size_t n_values = 0;
+
+    zassert_ok(batt_led_config_set("layer_persistence_threshold", 3));
+    for (size_t i = 0; batt_led_config_get(i, &name, &value) == 0; i++) {
+        if (strcmp(name, "layer_persistence_threshold") == 0) {
+            zassert_equal(value, 3);
+        } else if (strcmp(name, "interval_ms") == 0) {
+            zassert_equal(value, config_defaults.interval_ms);
+        }
+        n_values++;
+    }
+    zassert_equal(n_values, 8);
+}
+
+ZTEST(indicator_led_config, test_rejects_unknown_names) {
+    zassert_equal(batt_led_config_set("interval", 100), -ENOENT);
+    zassert_equal(memcmp(&batt_led_cfg, &config_defaults, sizeof(config_defaults)), 0);
+}
+
+ZTEST(indicator_led_config, test_rejects_invalid_values) {
+    // out of the field's range
+    zassert_equal(batt_led_config_set("battery_level_high", 256), -EINVAL);
+    zassert_equal(batt_led_config_set("interval_ms", 70000), -EINVAL);
+    // thresholds out of order
+    zassert_equal(batt_led_config_set("battery_level_low", 90), -EINVAL);
+    zassert_equal(batt_led_config_set("battery_level_high", 101), -EINVAL);
+
+    zassert_equal(memcmp(&batt_led_cfg, &config_defaults, sizeof(config_defaults)), 0);
+}
+
+ZTEST(indicator_led_config, test_saved_after_debounce) {
+    zassert_ok(batt_led_config_set("battery_high_blink_repeat", 7));
+    zassert_ok(batt_led_config_set("battery_low_blink_repeat", 9));
+    // nothing written before the debounce, however many values change
+    zassert_not_equal(stored_config().battery_low_blink_repeat, 9);
+
+    k_sleep(SAVE_WAIT);
+    struct batt_led_config stored = stored_config();
+    zassert_equal(stored.battery_high_blink_repeat, 7);
+    zassert_equal(stored.battery_low_blink_repeat, 9);
+}
+
+ZTEST(indicator_led_config, test_restored_on_load) {
+    zassert_ok(batt_led_config_set("battery_level_critical", 12));
+    k_sleep(SAVE_WAIT);
+
+    // as after a reboot
+    batt_led_cfg = config_defaults;
+    zassert_ok(settings_load_subtree("indicator_led"));
+    zassert_equal(batt_led_cfg.battery_level_critical, 12);
+}
+
+ZTEST_SUITE(indicator_led_config, NULL, config_setup, config_before, NULL, NULL);
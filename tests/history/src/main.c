@@ -0,0 +1,83 @@
+/*
+ * The battery history and its time-to-empty estimate, fed levels at known times: a steady
+ * discharge, charging in between, and gaps longer than a sample's delta holds.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// one percent less every 10 minutes, 0.1 %/min
+#define DISCHARGE_STEP_S 600
+
+static void history_before(void *fixture) {
+    // a rise restarts the history, leaving a full battery as its only sample
+    batt_led_history_add(1);
+    batt_led_history_add(100);
+    zassert_equal(batt_led_history_count(), 1);
+}
+
+// record levels from first down to last, one every DISCHARGE_STEP_S
+static void discharge(uint8_t first, uint8_t last) {
+    for (uint8_t level = first; level >= last; level--) {
+        k_sleep(K_SECONDS(DISCHARGE_STEP_S));
+        batt_led_history_add(level);
+    }
+}
+
+ZTEST(indicator_led_history, test_known_slope) {
+    uint32_t minutes;
+
+    // too few samples for a rate
+    discharge(99, 98);
+    zassert_equal(batt_led_history_time_to_empty(&minutes), -EAGAIN);
+
+    // 91 % left at 0.1 %/min
+    discharge(97, 91);
+    zassert_equal(batt_led_history_count(), 10);
+    zassert_ok(batt_led_history_time_to_empty(&minutes));
+    zassert_between_inclusive(minutes, 900, 920, "%u minutes estimated", minutes);
+}
+
+ZTEST(indicator_led_history, test_charging_resets) {
+    struct batt_led_history_sample sample;
+    uint32_t minutes;
+
+    discharge(99, 95);
+    zassert_ok(batt_led_history_time_to_empty(&minutes));
+
+    // a single percent up is noise of the level reading, and kept
+    batt_led_history_add(96);
+    zassert_equal(batt_led_history_count(), 7);
+
+    // more is charging, after which the old rate no longer holds
+    batt_led_history_add(98);
+    zassert_equal(batt_led_history_count(), 1);
+    zassert_ok(batt_led_history_get(0, &sample));
+    zassert_equal(sample.level, 98);
+    zassert_equal(batt_led_history_time_to_empty(&minutes), -EAGAIN);
+}
+
+ZTEST(indicator_led_history, test_delta_saturates) {
+    struct batt_led_history_sample sample;
+
+    // an unchanged level is not recorded again
+    k_sleep(K_SECONDS(10));
+    batt_led_history_add(100);
+    zassert_equal(batt_led_history_count(), 1);
+
+    // until its delta from the previous sample would no longer fit
+    k_sleep(K_SECONDS(UINT16_MAX));
+    batt_led_history_add(100);
+    zassert_equal(batt_led_history_count(), 2);
+    zassert_ok(batt_led_history_get(1, &sample));
+    zassert_equal(sample.age_s, UINT16_MAX);
+    zassert_equal(sample.level, 100);
+}
+
+ZTEST_SUITE(indicator_led_history, NULL, NULL, history_before, NULL, NULL);
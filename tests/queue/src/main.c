@@ -0,0 +1,163 @@
+/*
+ * The blink queue under storms of indications, for the overflow policy each scenario in
+ * testcase.yaml selects. Items carry a sequence number in their start time, which the queue
+ * passes through untouched, to tell which ones were kept.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+static const uint16_t test_steps[] = {50, 50};
+static const struct zmk_indicator_led_pattern test_pattern = ZMK_INDICATOR_LED_PATTERN(test_steps);
+
+// more than the queue holds many times over
+#define STORM_ITEMS 50
+
+static int put(uint8_t source, uint8_t priority, uint32_t seq) {
+    struct blink_item blink = {
+        .pattern = &test_pattern,
+        .source = source,
+        .n_repeats = 1,
+        .priority = priority,
+        .start = seq,
+    };
+    return batt_led_queue_put(&blink);
+}
+
+// check the queue holds items with these sequence numbers, oldest first
+static void assert_queued(const uint32_t *seqs, size_t n_seqs) {
+    struct blink_item blink;
+
+    zassert_equal(batt_led_queue_count(), n_seqs);
+    for (size_t i = 0; i < n_seqs; i++) {
+        zassert_ok(batt_led_queue_peek_at(i, &blink));
+        zassert_equal(blink.start, seqs[i], "item %zu is %u, not %u", i, blink.start, seqs[i]);
+    }
+}
+
+static void queue_before(void *fixture) {
+    struct blink_item blink;
+
+    while (batt_led_queue_get(&blink) == 0) {
+    }
+}
+
+ZTEST(indicator_led_queue, test_fifo_below_depth) {
+    struct blink_item blink;
+
+    for (uint32_t seq = 0; seq < BATT_LED_QUEUE_DEPTH; seq++) {
+        zassert_ok(put(seq, BATT_LED_PRIO_NORMAL, seq));
+    }
+    for (uint32_t seq = 0; seq < BATT_LED_QUEUE_DEPTH; seq++) {
+        zassert_ok(batt_led_queue_get(&blink));
+        zassert_equal(blink.start, seq);
+        zassert_equal(blink.source, seq);
+    }
+    zassert_equal(batt_led_queue_get(&blink), -ENOMSG);
+}
+
+ZTEST(indicator_led_queue, test_drop_newest_storm) {
+    Z_TEST_SKIP_IFNDEF(CONFIG_INDICATOR_LED_QUEUE_DROP_NEWEST);
+    static const uint32_t kept[] = {0, 1, 2, 3, 4, 5};
+
+    for (uint32_t seq = 0; seq < STORM_ITEMS; seq++) {
+        int expected = seq < BATT_LED_QUEUE_DEPTH ? 0 : -ENOMSG;
+        zassert_equal(put(0, BATT_LED_PRIO_CRITICAL, seq), expected);
+    }
+    assert_queued(kept, ARRAY_SIZE(kept));
+}
+
+ZTEST(indicator_led_queue, test_drop_oldest_storm) {
+    Z_TEST_SKIP_IFNDEF(CONFIG_INDICATOR_LED_QUEUE_DROP_OLDEST);
+    static const uint32_t kept[] = {44, 45, 46, 47, 48, 49};
+
+    for (uint32_t seq = 0; seq < STORM_ITEMS; seq++) {
+        zassert_ok(put(seq % 3, BATT_LED_PRIO_LOW, seq));
+    }
+    assert_queued(kept, ARRAY_SIZE(kept));
+}
+
+ZTEST(indicator_led_queue, test_replace_same_source_storm) {
+    Z_TEST_SKIP_IFNDEF(CONFIG_INDICATOR_LED_QUEUE_REPLACE_SAME_SOURCE);
+    // the newest item of each source keeps being replaced in place, so each source still ends on
+    // its latest state
+    static const uint32_t kept[] = {0, 1, 2, 48, 49, 47};
+
+    for (uint32_t seq = 0; seq < STORM_ITEMS; seq++) {
+        zassert_ok(put(seq % 3, BATT_LED_PRIO_NORMAL, seq));
+    }
+    assert_queued(kept, ARRAY_SIZE(kept));
+
+    // nothing of this source to replace
+    zassert_equal(put(3, BATT_LED_PRIO_CRITICAL, STORM_ITEMS), -ENOMSG);
+    assert_queued(kept, ARRAY_SIZE(kept));
+}
+
+ZTEST(indicator_led_queue, test_drop_lowest_priority_storm) {
+    Z_TEST_SKIP_IFNDEF(CONFIG_INDICATOR_LED_QUEUE_DROP_LOWEST_PRIORITY);
+    static const uint32_t mixed[] = {3, 4, 5, 10, 11, 12};
+    static const uint32_t kept[] = {144, 145, 146, 147, 148, 149};
+
+    for (uint32_t seq = 0; seq < BATT_LED_QUEUE_DEPTH; seq++) {
+        zassert_ok(put(0, BATT_LED_PRIO_LOW, seq));
+    }
+    // higher priorities evict the oldest low ones
+    for (uint32_t seq = 10; seq < 13; seq++) {
+        zassert_ok(put(1, BATT_LED_PRIO_CRITICAL, seq));
+    }
+    assert_queued(mixed, ARRAY_SIZE(mixed));
+
+    // a storm of criticals leaves the newest of them
+    for (uint32_t seq = 100; seq < 100 + STORM_ITEMS; seq++) {
+        zassert_ok(put(1, BATT_LED_PRIO_CRITICAL, seq));
+    }
+    assert_queued(kept, ARRAY_SIZE(kept));
+
+    // lower than everything queued
+    zassert_equal(put(0, BATT_LED_PRIO_LOW, 200), -ENOMSG);
+    assert_queued(kept, ARRAY_SIZE(kept));
+}
+
+// sequence numbers put by the ISR storm below
+static atomic_t storm_seq;
+
+static void storm_timer_expiry(struct k_timer *timer) {
+    uint32_t seq = atomic_inc(&storm_seq);
+
+    put(seq % 4, seq % 2 ? BATT_LED_PRIO_HIGH : BATT_LED_PRIO_LOW, seq);
+}
+
+static K_TIMER_DEFINE(storm_timer, storm_timer_expiry, NULL);
+
+ZTEST(indicator_led_queue, test_isr_storm) {
+    static ATOMIC_DEFINE(seen, 1024);
+    struct blink_item blink;
+    uint32_t n_taken = 0;
+
+    // the player taking items while they are put from interrupts
+    atomic_set(&storm_seq, 0);
+    k_timer_start(&storm_timer, K_MSEC(1), K_MSEC(1));
+    while (atomic_get(&storm_seq) < 200) {
+        zassert_true(batt_led_queue_count() <= BATT_LED_QUEUE_DEPTH);
+        if (batt_led_queue_get(&blink) == 0) {
+            zassert_equal_ptr(blink.pattern, &test_pattern);
+            zassert_equal(blink.source, blink.start % 4);
+            zassert_false(atomic_test_and_set_bit(seen, blink.start), "%u taken twice",
+                          blink.start);
+            n_taken++;
+        }
+        k_sleep(K_MSEC(n_taken % 3));
+    }
+    k_timer_stop(&storm_timer);
+
+    zassert_true(n_taken > 0);
+    zassert_true(batt_led_queue_count() <= BATT_LED_QUEUE_DEPTH);
+}
+
+ZTEST_SUITE(indicator_led_queue, NULL, NULL, queue_before, NULL, NULL);
@@ -0,0 +1,134 @@
+/*
+ * Skew between the halves of a split playing a synchronized indication, at their LED edges.
+ *
+ * Both halves run in this one instance, taking turns with the relay's receive path and the
+ * player: the central plays a frame after the sync lead, and the peripheral receives the same
+ * frame after the BLE link delay, with the delay the central computed for the connection
+ * interval. Each half's first lit edge is timed from the moment the central handed the frame to
+ * the link. The link delay is swept over the connection interval, and wherever it falls, the
+ * edges must be at most half an interval apart.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/ztest.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// a single short step, so that the sweep does not take long
+static const uint16_t test_steps[] = {10};
+
+static const struct zmk_indicator_led_pattern test_patterns[] = {
+    ZMK_INDICATOR_LED_PATTERN(test_steps),
+};
+
+static struct batt_led_source_state test_source_state;
+
+static const struct batt_led_source test_source = {
+    .name = "test",
+    .id = BATT_LED_SOURCE_ID_LAYER,
+    .patterns = test_patterns,
+    .pattern_count = ARRAY_SIZE(test_patterns),
+    .state = &test_source_state,
+};
+
+const struct batt_led_source *batt_led_source_find(uint8_t id) {
+    return id == test_source.id ? &test_source : NULL;
+}
+
+// uptime of the first lit edge since the last frame, 0 before it
+static atomic_t lit_at;
+
+// the LED compositor, reduced to timing the player's first lit step
+void batt_led_foreground_update(bool active, uint8_t level) {
+    if (active && level > 0) {
+        atomic_cas(&lit_at, 0, (atomic_val_t)k_uptime_get_32());
+    }
+}
+
+void batt_led_background_update(uint32_t clear, uint32_t set) {
+}
+
+void batt_led_compositor_state(uint8_t *level, bool *background) {
+    *level = 0;
+    *background = false;
+}
+
+// the timer's granularity, which either edge may land late by
+#define EDGE_SLACK_MS 1
+
+// receive a one indication frame link_ms after it was sent, returning the time from sending it
+// until the LED lit
+static int32_t play_frame(uint32_t link_ms, uint16_t delay_ms) {
+    uint8_t frame[] = {1, 0, 0, test_source.id, 0, 1};
+    struct zmk_indicator_led_state state;
+    uint32_t sent = k_uptime_get_32();
+
+    sys_put_le16(delay_ms, &frame[1]);
+    atomic_set(&lit_at, 0);
+    k_sleep(K_TIMEOUT_ABS_MS((int64_t)sent + link_ms));
+    zassert_ok(batt_led_relay_receive(frame, sizeof(frame)));
+
+    // wait for the sequence to end, so that the next frame finds the player idle
+    for (int i = 0; i < 100; i++) {
+        k_sleep(K_MSEC(5));
+        zmk_indicator_led_get_state(&state);
+        if (atomic_get(&lit_at) != 0 && state.playing_source < 0) {
+            return (int32_t)((uint32_t)atomic_get(&lit_at) - sent);
+        }
+    }
+    zassert_unreachable("Frame with delay %u ms never played", delay_ms);
+    return 0;
+}
+
+static void measure_skew(uint32_t interval_ms) {
+    uint16_t delay_ms = batt_led_relay_sync_delay_ms(interval_ms);
+    // the central plays the frame itself as it hands it to the link
+    int32_t central_ms = play_frame(0, CONFIG_INDICATOR_LED_SPLIT_SYNC_LEAD_MS);
+    int32_t max_skew_ms = 0;
+
+    // the peripheral gets it at the next connection event, anywhere within the interval
+    for (uint32_t link_ms = 0; link_ms < interval_ms; link_ms += MAX(interval_ms / 20, 1)) {
+        int32_t skew_ms = play_frame(link_ms, delay_ms) - central_ms;
+
+        max_skew_ms = MAX(max_skew_ms, ABS(skew_ms));
+    }
+
+    TC_PRINT("interval %u ms: central lit after %d ms, peripheral delay %u ms, skew at most %d "
+             "ms\n",
+             interval_ms, central_ms, delay_ms, max_skew_ms);
+    zassert_true(max_skew_ms <= interval_ms / 2 + EDGE_SLACK_MS,
+                 "skew of %d ms at %u ms interval", max_skew_ms, interval_ms);
+}
+
+ZTEST(indicator_led_split_sync, test_skew_within_half_interval) {
+    // the intervals ZMK uses for the split link, and slower ones
+    static const uint32_t intervals_ms[] = {7, 15, 30, 50, 100};
+
+    for (size_t i = 0; i < ARRAY_SIZE(intervals_ms); i++) {
+        // a lead shorter than half the interval cannot hide the link delay
+        if (intervals_ms[i] / 2 > CONFIG_INDICATOR_LED_SPLIT_SYNC_LEAD_MS) {
+            TC_PRINT("interval %u ms: longer than the lead covers\n", intervals_ms[i]);
+            continue;
+        }
+        measure_skew(intervals_ms[i]);
+    }
+}
+
+ZTEST(indicator_led_split_sync, test_delay_never_exceeds_lead) {
+    for (uint32_t interval_ms = 0; interval_ms <= 4000; interval_ms += 5) {
+        zassert_true(batt_led_relay_sync_delay_ms(interval_ms) <=
+                     CONFIG_INDICATOR_LED_SPLIT_SYNC_LEAD_MS);
+    }
+}
+
+ZTEST(indicator_led_split_sync, test_zero_delay_plays_at_once) {
+    // the agreed start has come already, so no pre-roll may hold it back behind the other half
+    zassert_true(play_frame(0, 0) <= EDGE_SLACK_MS, "played late");
+}
+
+ZTEST_SUITE(indicator_led_split_sync, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,110 @@
+/*
+ * Peak stack usage of the module's timer thread, which CONFIG_INDICATOR_LED_THREAD_STACK_SIZE is
+ * sized from.
+ *
+ * Drives what runs on the thread: the boot indications with a layer change replayed after them,
+ * layer changes through the player and, in the relay scenarios, through the central's batching
+ * and the loopback relay, and API sequences of every generator, one of them cancelled while
+ * playing. The scenarios in testcase.yaml run this with logging and the relay on and off; each
+ * prints the peak, and checks the default stack size leaves the margin on top of it.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <zephyr/logging/log.h>
+
+#include <zmk/event_manager.h>
+#include <zmk/events/battery_state_changed.h>
+#include <zmk/events/layer_state_changed.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+// what the default stack sizes in Kconfig add to the peak: half of it, and room for what this
+// test leaves out, the boot battery sensor read, interrupt frames and, with the relay, writes
+// into the Bluetooth host instead of the loopback
+#define STACK_MARGIN(peak) \
+    ((peak) / 2 + (IS_ENABLED(CONFIG_INDICATOR_LED_SPLIT_RELAY) ? 512 : 256))
+
+// the module subscribes to these
+ZMK_EVENT_IMPL(zmk_battery_state_changed);
+ZMK_EVENT_IMPL(zmk_layer_state_changed);
+
+static uint8_t highest_layer;
+
+uint8_t zmk_battery_state_of_charge(void) {
+    // high, so that the boot indication shows it right away
+    return 90;
+}
+
+uint8_t zmk_keymap_highest_layer_active(void) {
+    return highest_layer;
+}
+
+static const uint16_t test_steps[] = {30, 30, 30, 60};
+static const struct zmk_indicator_led_pattern test_patterns[] = {
+    ZMK_INDICATOR_LED_PATTERN(test_steps),
+    ZMK_INDICATOR_LED_BREATHE(400, 20),
+    ZMK_INDICATOR_LED_CHIRP(200, 50, 6),
+};
+
+// a layer change, as the module's layer listener passes it on
+static void layer_change(uint8_t layer) {
+    highest_layer = layer;
+    batt_led_source_event(batt_led_source_find(BATT_LED_SOURCE_ID_LAYER), NULL);
+}
+
+static void wait_idle(void) {
+    struct zmk_indicator_led_state state;
+
+    for (int i = 0; i < 300; i++) {
+        k_sleep(K_MSEC(100));
+        zmk_indicator_led_get_state(&state);
+        if (state.playing_source < 0 && state.queued == 0) {
+            return;
+        }
+    }
+    zassert_unreachable("Player still busy");
+}
+
+ZTEST(indicator_led_stack, test_peak) {
+    // before the boot indications, replayed after them
+    layer_change(1);
+    k_sleep(K_MSEC(300));
+    wait_idle();
+
+    for (uint8_t layer = 2; layer < 6; layer++) {
+        layer_change(layer);
+        k_sleep(K_MSEC(30));
+    }
+    wait_idle();
+
+    for (size_t i = 0; i < ARRAY_SIZE(test_patterns); i++) {
+        zassert_ok(zmk_indicator_led_enqueue(ZMK_INDICATOR_LED_SOURCE_USER, &test_patterns[i], 2,
+                                             ZMK_INDICATOR_LED_PRIO_NORMAL,
+                                             ZMK_INDICATOR_LED_FLAG_INDEX));
+    }
+    zassert_ok(zmk_indicator_led_enqueue(ZMK_INDICATOR_LED_SOURCE_USER + 1, &test_patterns[0], 1,
+                                         ZMK_INDICATOR_LED_PRIO_HIGH,
+                                         ZMK_INDICATOR_LED_FLAG_HOLD));
+    k_sleep(K_MSEC(500));
+    zassert_ok(zmk_indicator_led_cancel(ZMK_INDICATOR_LED_SOURCE_USER));
+    wait_idle();
+    zassert_ok(zmk_indicator_led_cancel(ZMK_INDICATOR_LED_SOURCE_USER + 1));
+    // one more wakeup, to check the stack after the last sequence ended
+    layer_change(0);
+    wait_idle();
+
+    size_t peak = batt_led_timer_stack_peak();
+    size_t needed = peak + STACK_MARGIN(peak);
+    TC_PRINT("timer thread stack peak %zu bytes, %zu with margin, %d configured\n", peak, needed,
+             CONFIG_INDICATOR_LED_THREAD_STACK_SIZE);
+    zassert_true(peak > 0, "No stack usage recorded");
+    zassert_true(needed <= CONFIG_INDICATOR_LED_THREAD_STACK_SIZE,
+                 "%zu bytes of stack needed, %d configured", needed,
+                 CONFIG_INDICATOR_LED_THREAD_STACK_SIZE);
+}
+
+ZTEST_SUITE(indicator_led_stack, NULL, NULL, NULL, NULL, NULL);
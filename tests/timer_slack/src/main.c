@@ -0,0 +1,109 @@
+/*
+ * Wakeups of the module's timer thread for a workload of timers close to each other, as LED edges
+ * and other module timers are. The scenarios in testcase.yaml run it with and without timer
+ * slack; compare the wakeup counts they print.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include <zephyr/logging/log.h>
+
+#include "batt_leds.h"
+
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#define TICK_MS MAX(2 * CONFIG_INDICATOR_LED_TIMER_SLACK_MS, 1)
+
+// edges of a layer indication, {80, 120} ms played four times
+#define N_EDGES 8
+static const uint16_t edge_steps_ms[] = {80, 120};
+
+// another module timer this far after each edge, e.g. relay batching or a settings debounce
+#define NEIGHBOUR_OFFSET_MS 6
+
+struct test_timer {
+    struct batt_led_timer timer;
+    int64_t deadline;
+    int64_t fired;
+};
+
+static struct test_timer timers[2 * N_EDGES];
+
+static void test_timer_expiry(struct batt_led_timer *timer) {
+    struct test_timer *t = CONTAINER_OF(timer, struct test_timer, timer);
+
+    t->fired = k_uptime_get();
+}
+
+#define WHEEL_SLOTS 16
+#define WHEEL_LEVELS 4
+
+static bool tick_listed(const int64_t *ticks, uint32_t n_ticks, int64_t tick) {
+    for (uint32_t i = 0; i < n_ticks; i++) {
+        if (ticks[i] == tick) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Ticks the wheel has to visit after start_tick: those the deadlines round to, and the starts of
+// the slots higher levels move them down from. The fewest wakeups the thread can make.
+static uint32_t wheel_ticks(int64_t start_tick) {
+    static int64_t ticks[ARRAY_SIZE(timers) * WHEEL_LEVELS];
+    uint32_t n_ticks = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(timers); i++) {
+        int64_t expires = (timers[i].deadline + TICK_MS / 2) / TICK_MS;
+        int64_t slot_ticks = 1;
+        for (uint8_t level = 0; level < WHEEL_LEVELS; level++, slot_ticks *= WHEEL_SLOTS) {
+            int64_t tick = expires - expires % slot_ticks;
+            if (tick > start_tick && !tick_listed(ticks, n_ticks, tick)) {
+                ticks[n_ticks++] = tick;
+            }
+        }
+    }
+    return n_ticks;
+}
+
+ZTEST(indicator_led_timer_slack, test_wakeups) {
+    int64_t start_tick = k_uptime_get() / TICK_MS;
+    int64_t deadline = k_uptime_get() + 100;
+
+    for (size_t i = 0; i < N_EDGES; i++) {
+        timers[2 * i].deadline = deadline;
+        timers[2 * i + 1].deadline = deadline + NEIGHBOUR_OFFSET_MS;
+        deadline += edge_steps_ms[i % ARRAY_SIZE(edge_steps_ms)];
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(timers); i++) {
+        timers[i].timer = (struct batt_led_timer)BATT_LED_TIMER_INITIALIZER(test_timer_expiry);
+        timers[i].fired = 0;
+        batt_led_timer_start(&timers[i].timer, timers[i].deadline);
+    }
+
+    // let the thread pick up the new timers, which wakes it once
+    k_sleep(K_MSEC(1));
+    uint32_t wakeups_before = batt_led_timer_wakeups();
+    k_sleep(K_MSEC(deadline - k_uptime_get() + 50));
+    uint32_t wakeups = batt_led_timer_wakeups() - wakeups_before;
+
+    uint32_t n_ticks = wheel_ticks(start_tick);
+    TC_PRINT("%zu timers, %u wheel ticks: %u wakeups with %d ms slack\n", ARRAY_SIZE(timers),
+             n_ticks, wakeups, CONFIG_INDICATOR_LED_TIMER_SLACK_MS);
+
+    for (size_t i = 0; i < ARRAY_SIZE(timers); i++) {
+        // moved by at most the slack, and whatever the thread takes to get scheduled
+        zassert_between_inclusive(timers[i].fired - timers[i].deadline,
+                                  -CONFIG_INDICATOR_LED_TIMER_SLACK_MS,
+                                  CONFIG_INDICATOR_LED_TIMER_SLACK_MS + 1,
+                                  "timer %zu fired at %lld for %lld", i, timers[i].fired,
+                                  timers[i].deadline);
+    }
+    zassert_true(wakeups <= n_ticks, "%u wakeups for %u ticks", wakeups, n_ticks);
+    if (CONFIG_INDICATOR_LED_TIMER_SLACK_MS > 0) {
+        zassert_true(wakeups < ARRAY_SIZE(timers), "slack did not save any wakeups");
+    }
+}
+
+ZTEST_SUITE(indicator_led_timer_slack, NULL, NULL, NULL, NULL, NULL);